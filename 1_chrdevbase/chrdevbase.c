@@ -4,83 +4,1931 @@
 #include <linux/ide.h>
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/uio.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+
+/*在这个文件中生成tracepoint的定义*/
+#define CREATE_TRACE_POINTS
+#include "chrdevbase_trace.h"
 
 /*该设备运行在内核空间，会有用户空间的程序对这个设备进行访问，和用户空间通信的缓冲区:形参中的char __user *buf */
 
-/*主设备号和名称*/
-#define CHRDEVBASE_MAJOR 200
+/*设备名称，主设备号由内核动态分配*/
 #define CHRDEVBASE_NAME "chardevbase"
 
-/*读缓冲区和写缓存区*/
-static char readbuf[100];
-static char writebuf[100];
-static char kerneldata[] = "kernel data";
+/*默认的次设备号（实例）个数*/
+#define CHRDEVBASE_CNT 1
+
+/*缓冲区的默认大小（管道和分帧模式下为上限），会向上取整为2的幂*/
+#define CHRDEVBASE_FIFO_SIZE 4096
+
+/*工作模式*/
+#define CHRDEVBASE_MODE_PIPE 0 /*kfifo管道，通过read/write拷贝数据*/
+#define CHRDEVBASE_MODE_MMAP 1 /*共享环形缓冲区，用户空间mmap后直接读写*/
+#define CHRDEVBASE_MODE_STORE 2 /*可lseek的大容量存储区，支持pread/pwrite*/
+#define CHRDEVBASE_MODE_PRIVATE 3 /*每次open得到私有的kfifo，写入的数据由同一个文件描述符读回*/
+#define CHRDEVBASE_MODE_BROADCAST 4 /*广播：每次write为一条消息，每个文件描述符都能读到open之后的所有消息*/
+#define CHRDEVBASE_MODE_FRAMED 5 /*分帧：每次write为一条记录，一次read返回能放下的所有完整记录*/
+
+/*存储模式的默认容量*/
+#define CHRDEVBASE_STORE_SIZE (4 * 1024 * 1024)
+
+/*延时直方图的桶数，第i个桶统计耗时在[2^(i-1), 2^i)纳秒之间的操作，最后一个桶包含所有更长的操作*/
+#define CHRDEVBASE_HIST_BUCKETS 32
+
+/*ioctl命令，mmap模式下用户空间只在需要休眠或唤醒对方时才进入内核*/
+#define CHRDEVBASE_IOC_MAGIC      0xEC
+#define CHRDEVBASE_IOC_WAIT_DATA  (_IO(CHRDEVBASE_IOC_MAGIC, 0x1)) /*等待环形缓冲区中有数据*/
+#define CHRDEVBASE_IOC_WAIT_SPACE (_IO(CHRDEVBASE_IOC_MAGIC, 0x2)) /*等待环形缓冲区中有空间*/
+#define CHRDEVBASE_IOC_WAKE       (_IO(CHRDEVBASE_IOC_MAGIC, 0x3)) /*更新head/tail后唤醒对方*/
+#define CHRDEVBASE_IOC_GET_STATS  (_IOR(CHRDEVBASE_IOC_MAGIC, 0x4, struct chrdevbase_stats)) /*获取本文件描述符的统计信息*/
+
+#define CHRDEVBASE_CACHELINE 64 /*head和tail分别放在不同的cache line中，避免伪共享*/
+
+/*
+mmap共享环形缓冲区的头部，位于映射区域的第一页，数据区紧随其后
+head和tail自由增长，使用时对size取模；head只由生产者写，tail只由消费者写
+xxx_waiting由内核在休眠前置1，对方更新索引后发现其为1时调用CHRDEVBASE_IOC_WAKE
+该结构体与chrdevbaseApp.c中的定义保持一致
+*/
+struct chrdevbase_ring_hdr
+{
+    __u32 size;        /*数据区大小，2的幂*/
+    __u32 data_offset; /*数据区相对于映射起始地址的偏移*/
+    __u8 pad0[CHRDEVBASE_CACHELINE - 2 * sizeof(__u32)];
+    __u32 head;             /*生产者位置*/
+    __u32 consumer_waiting; /*消费者正在等待数据*/
+    __u8 pad1[CHRDEVBASE_CACHELINE - 2 * sizeof(__u32)];
+    __u32 tail;             /*消费者位置*/
+    __u32 producer_waiting; /*生产者正在等待空间*/
+    __u8 pad2[CHRDEVBASE_CACHELINE - 2 * sizeof(__u32)];
+};
+
+/*工作模式，加载模块时可以通过mode=x指定*/
+static int mode = CHRDEVBASE_MODE_PIPE;
+module_param(mode, int, 0444);
+MODULE_PARM_DESC(mode, "0 = kfifo pipe, 1 = mmap shared ring, 2 = seekable page store, 3 = private per-open fifo, 4 = broadcast, 5 = framed records");
+
+/*
+每个实例的缓冲区大小，加载模块时可以通过fifo_size=xxx指定
+管道和分帧模式下缓冲区从一页开始，写者需要时倍增到fifo_size，内存紧张时由shrinker缩回
+*/
+static unsigned int fifo_size = CHRDEVBASE_FIFO_SIZE;
+module_param(fifo_size, uint, 0444);
+MODULE_PARM_DESC(fifo_size, "buffer size in bytes (rounded up to a power of two); pipe/framed modes grow up to this on demand");
+
+/*存储模式下每个实例的容量，加载模块时可以通过store_size=xxx指定，向上取整到页*/
+static unsigned long store_size = CHRDEVBASE_STORE_SIZE;
+module_param(store_size, ulong, 0444);
+MODULE_PARM_DESC(store_size, "store mode capacity in bytes (rounded up to a page)");
+
+/*
+管道模式下的写回缓冲：write只追加到暂存区后立即返回，由延迟工作批量搬到读者可见的fifo中
+fsync等待暂存区全部可见，close时把能搬的数据搬过去；writeback=0为写直达，write返回时数据已经可读
+*/
+static bool writeback;
+module_param(writeback, bool, 0444);
+MODULE_PARM_DESC(writeback, "pipe mode: stage writes and publish them from a deferred worker (0 = write-through)");
+
+/*写回的延迟，暂存区超过一半时不等延迟立即搬运*/
+static unsigned int writeback_ms = 10;
+module_param(writeback_ms, uint, 0644);
+MODULE_PARM_DESC(writeback_ms, "pipe mode write-back delay in milliseconds");
+
+/*广播模式下读者落后太多、消息已被覆盖时：false跳到最旧的消息继续读，true先返回一次-EPIPE*/
+static bool overrun_error;
+module_param(overrun_error, bool, 0644);
+MODULE_PARM_DESC(overrun_error, "broadcast mode: report a reader overrun with -EPIPE instead of skipping silently");
+
+/*普通实例的个数，每个实例对应一个次设备号：/dev/chardevbase0 ~ /dev/chardevbase<N-1>*/
+static unsigned int minors = CHRDEVBASE_CNT;
+module_param(minors, uint, 0444);
+MODULE_PARM_DESC(minors, "number of chardevbase<N> instances");
+
+/*为每个CPU额外创建一个实例：/dev/chardevbase_cpu<N>，实例内存分配在该CPU所在的节点上*/
+static bool percpu;
+module_param(percpu, bool, 0444);
+MODULE_PARM_DESC(percpu, "also create one chardevbase_cpu<N> instance per possible CPU");
+
+/*每个打开的文件描述符的统计信息，通过CHRDEVBASE_IOC_GET_STATS获取*/
+struct chrdevbase_stats
+{
+    __u64 read_ops;    /*成功的读操作次数*/
+    __u64 read_bytes;  /*读出的字节数*/
+    __u64 write_ops;   /*成功的写操作次数*/
+    __u64 write_bytes; /*写入的字节数*/
+};
+
+/*
+实例的统计信息，每个CPU一份，热路径上只用this_cpu_*修改本CPU的计数，不加锁也不会在CPU之间争抢cache line
+读取时把所有CPU的计数相加，32位系统上读到的u64计数可能不是同一时刻的值，用于统计已经足够
+*/
+struct chrdevbase_pcpu_stats
+{
+    u64 read_ops;      /*成功的读操作次数*/
+    u64 read_bytes;    /*读出的字节数*/
+    u64 short_reads;   /*返回的字节数少于请求长度的读操作次数*/
+    u64 write_ops;     /*成功的写操作次数*/
+    u64 write_bytes;   /*写入的字节数*/
+    u64 blocked_waits; /*因为缓冲区空或满而休眠的次数*/
+    u64 overruns;      /*广播模式：读者的消息被覆盖的次数*/
+    u64 read_records;  /*分帧模式：读出的记录数，除以read_ops即为每次read平均取走的记录数*/
+    u64 wb_batches;    /*写回：从暂存区搬运的批次数*/
+    u64 wb_bytes;      /*写回：从暂存区搬运的字节数*/
+    u64 fifo_grows;    /*管道和分帧模式：缓冲区扩大的次数*/
+    u64 fifo_shrinks;  /*管道和分帧模式：shrinker缩小缓冲区的次数*/
+    u64 read_hist[CHRDEVBASE_HIST_BUCKETS];  /*read耗时的log2直方图*/
+    u64 write_hist[CHRDEVBASE_HIST_BUCKETS]; /*write耗时的log2直方图*/
+};
+
+/*修改本CPU上的统计计数*/
+#define chrdevbase_stat_add(dev, field, n) this_cpu_add((dev)->pcpu_stats->field, (n))
+#define chrdevbase_stat_inc(dev, field)    this_cpu_inc((dev)->pcpu_stats->field)
+
+/*
+chrdevbase设备结构体，每个次设备号一个实例，各自拥有缓冲区、锁和统计信息
+实例之间不共享任何可写数据，kzalloc按cache line对齐，不同实例不会伪共享
+*/
+struct chrdevbase_dev
+{
+    struct cdev cdev;         /*cdev*/
+    struct device *device;    /*设备*/
+    int minor;                /*次设备号*/
+    int mode;                 /*工作模式*/
+    struct kfifo fifo;        /*管道和分帧模式：内核与用户空间之间的环形缓冲区*/
+    unsigned int fifo_min;    /*管道和分帧模式：缓冲区的初始大小，shrinker不会缩到更小*/
+    unsigned int fifo_cap;    /*管道和分帧模式：缓冲区大小的上限*/
+    bool grow_failed;         /*管道和分帧模式：上一次扩大缓冲区失败，下一次扩大成功或读者取走数据后清除，poll据此不再按上限报告可写*/
+    bool writeback;           /*管道模式：写入先进入暂存区*/
+    struct kfifo staging;     /*写回：暂存区，写者只操作这里，与fifo一样在fifo_min和fifo_cap之间伸缩*/
+    struct delayed_work wb_work; /*写回：把暂存区搬到fifo的延迟工作*/
+    void *ring;               /*mmap模式：头部页+数据区，vmalloc_user分配*/
+    struct chrdevbase_ring_hdr *hdr; /*mmap模式：环形缓冲区头部*/
+    char *ring_data;          /*mmap模式：数据区*/
+    unsigned int ring_size;   /*mmap模式：数据区大小*/
+    struct page **pages;      /*存储模式：页指针数组，页在第一次写入时才分配*/
+    unsigned long nr_pages;   /*存储模式：页指针数组的长度*/
+    unsigned long store_pages; /*存储模式：已经分配的页数，在持有lock时修改*/
+    loff_t store_size;        /*存储模式：容量*/
+    char *bcast;              /*广播模式：消息环形缓冲区，每条消息为4字节长度+数据*/
+    unsigned int bcast_size;  /*广播模式：缓冲区大小，2的幂*/
+    u64 bcast_head;           /*广播模式：下一条消息写入的位置，自由增长，在持有lock时修改*/
+    u64 bcast_tail;           /*广播模式：最旧的一条消息的位置，写者覆盖旧消息时向前移动*/
+    struct mutex lock;        /*串行化内核中的读者和写者*/
+    wait_queue_head_t r_wait; /*读等待队列，缓冲区为空时读者在此休眠*/
+    wait_queue_head_t w_wait; /*写等待队列，缓冲区已满时写者在此休眠*/
+    struct fasync_struct *async_queue; /*异步通知，有数据可读或有空间可写时发送SIGIO*/
+    struct chrdevbase_pcpu_stats __percpu *pcpu_stats; /*每CPU统计信息*/
+    struct dentry *debugfs;   /*debugfs目录：/sys/kernel/debug/chardevbase/<设备名>*/
+};
+
+/*chrdevbase驱动的全局信息*/
+struct chrdevbase_drv
+{
+    dev_t devid;                  /*起始设备号*/
+    int major;                    /*主设备号*/
+    struct class *class;          /*类*/
+    struct dentry *debugfs;       /*debugfs根目录*/
+    unsigned int nr_devs;         /*实例（次设备号）总数*/
+    struct chrdevbase_dev **devs; /*按次设备号索引的实例数组*/
+};
+
+static struct chrdevbase_drv chrdevbase; /*chrdevbase驱动*/
+
+/*
+每次open分配的私有上下文，挂在filp->private_data上
+私有模式下上下文中带有自己的kfifo和锁，不同的文件描述符之间互不影响
+广播模式下上下文中只有读游标，所有读者共享实例中的同一份消息
+*/
+struct chrdevbase_ctx
+{
+    struct chrdevbase_dev *dev;    /*所属的实例*/
+    struct chrdevbase_stats stats; /*本文件描述符的统计信息*/
+    struct kfifo fifo;             /*私有模式：私有的环形缓冲区，数据区为buf*/
+    struct mutex lock;             /*私有模式：保护fifo*/
+    wait_queue_head_t r_wait;      /*私有模式：读等待队列*/
+    wait_queue_head_t w_wait;      /*私有模式：写等待队列*/
+    struct fasync_struct *async_queue; /*私有模式：异步通知*/
+    u64 cursor;                    /*广播模式：下一条要读的消息的位置，在持有dev->lock时访问*/
+    u32 frame_need;                /*分帧模式：上一次因为空间不够而返回-EAGAIN的记录需要的字节数（含记录头），写入成功后清0*/
+    unsigned char buf[];           /*私有模式：kfifo的数据区，与上下文一起从slab分配*/
+};
+
+/*上下文的slab缓存，频繁open/close时直接复用释放掉的对象*/
+static struct kmem_cache *chrdevbase_ctx_cache;
+static unsigned int chrdevbase_ctx_buf_size; /*私有模式下每个上下文的缓冲区大小*/
+
+/*
+描述：mmap模式下环形缓冲区中已有的数据量
+参数：dev：设备结构体
+return：数据字节数，索引被用户空间破坏时返回值大于ring_size
+*/
+static unsigned int chrdevbase_ring_used(struct chrdevbase_dev *dev)
+{
+    /*acquire保证先看到head，再读到生产者写入的数据*/
+    return smp_load_acquire(&dev->hdr->head) - READ_ONCE(dev->hdr->tail);
+}
+
+/*
+描述：判断设备是否可读，mmap模式下顺便登记消费者正在等待
+参数：dev：设备结构体
+return：true可读；false不可读
+*/
+static bool chrdevbase_readable(struct chrdevbase_dev *dev)
+{
+    if (dev->mode == CHRDEVBASE_MODE_MMAP)
+    {
+        /*先置等待标志再检查head，与生产者的"先写head再检查标志"配对*/
+        WRITE_ONCE(dev->hdr->consumer_waiting, 1);
+        smp_mb();
+        return chrdevbase_ring_used(dev) != 0;
+    }
+    if (dev->mode == CHRDEVBASE_MODE_STORE)
+    {
+        return true; /*存储区随时可读，读到未分配的页时返回0*/
+    }
+    return !kfifo_is_empty(&dev->fifo);
+}
+
+/*
+描述：判断设备是否可写，mmap模式下顺便登记生产者正在等待
+参数：dev：设备结构体
+return：true可写；false不可写
+*/
+static bool chrdevbase_writable(struct chrdevbase_dev *dev)
+{
+    if (dev->mode == CHRDEVBASE_MODE_MMAP)
+    {
+        WRITE_ONCE(dev->hdr->producer_waiting, 1);
+        smp_mb();
+        return chrdevbase_ring_used(dev) < dev->ring_size;
+    }
+    if (dev->mode == CHRDEVBASE_MODE_STORE)
+    {
+        return true;
+    }
+    if (dev->mode == CHRDEVBASE_MODE_FRAMED)
+    {
+        return kfifo_avail(&dev->fifo) > sizeof(u32); /*至少放得下记录头和一个字节*/
+    }
+    if (dev->writeback)
+    {
+        return !kfifo_is_full(&dev->staging); /*写者只等暂存区*/
+    }
+    return !kfifo_is_full(&dev->fifo);
+}
+
+/*
+描述：从环形缓冲区的off处拷贝len个字节到iov_iter，数据跨过缓冲区末尾时分两段拷贝
+参数：data：缓冲区起始地址
+      size：缓冲区大小，2的幂
+      off：起始偏移
+      len：要拷贝的字节数
+      to：目的iov_iter，可以是用户空间的iovec，也可以是splice使用的内核页
+return：实际拷贝的字节数
+*/
+static size_t chrdevbase_copy_to_iter(char *data, unsigned int size, unsigned int off, unsigned int len, struct iov_iter *to)
+{
+    unsigned int first = min(len, size - off); /*回绕前的第一段*/
+    size_t copied;
+
+    copied = copy_to_iter(data + off, first, to);
+    if (copied == first && len > first)
+    {
+        copied += copy_to_iter(data, len - first, to);
+    }
+    return copied;
+}
+
+/*
+描述：从iov_iter拷贝len个字节到环形缓冲区的off处，数据跨过缓冲区末尾时分两段拷贝
+参数：data：缓冲区起始地址
+      size：缓冲区大小，2的幂
+      off：起始偏移
+      len：要拷贝的字节数
+      from：源iov_iter，writev时包含多个用户空间缓冲区
+return：实际拷贝的字节数
+*/
+static size_t chrdevbase_copy_from_iter(char *data, unsigned int size, unsigned int off, unsigned int len, struct iov_iter *from)
+{
+    unsigned int first = min(len, size - off);
+    size_t copied;
+
+    copied = copy_from_iter(data + off, first, from);
+    if (copied == first && len > first)
+    {
+        copied += copy_from_iter(data, len - first, from);
+    }
+    return copied;
+}
+
+/*
+描述：从kfifo拷贝数据到iov_iter，调用者持有保护该kfifo的锁
+      kfifo只提供了copy_to_user接口，这里仿照kfifo_to_user直接操作__kfifo的索引
+参数：kfifo：管道模式下为实例的fifo，私有模式下为上下文的fifo
+      to：目的iov_iter
+return：读取的字节数，负数表示失败
+*/
+static ssize_t chrdevbase_fifo_read(struct kfifo *kfifo, struct iov_iter *to)
+{
+    struct __kfifo *fifo = &kfifo->kfifo;
+    unsigned int len = min_t(size_t, kfifo_len(kfifo), iov_iter_count(to));
+    size_t copied;
+
+    copied = chrdevbase_copy_to_iter(fifo->data, fifo->mask + 1, fifo->out & fifo->mask, len, to);
+    if (copied == 0)
+    {
+        return -EFAULT;
+    }
+
+    /*数据拷贝完成以后再更新out，与kfifo的实现一致*/
+    smp_wmb();
+    fifo->out += copied;
+    return copied;
+}
+
+/*
+描述：从iov_iter拷贝数据到kfifo，调用者持有保护该kfifo的锁
+参数：kfifo：管道模式下为实例的fifo，私有模式下为上下文的fifo
+      from：源iov_iter
+return：写入的字节数，负数表示失败
+*/
+static ssize_t chrdevbase_fifo_write(struct kfifo *kfifo, struct iov_iter *from)
+{
+    struct __kfifo *fifo = &kfifo->kfifo;
+    unsigned int len = min_t(size_t, kfifo_avail(kfifo), iov_iter_count(from));
+    size_t copied;
+
+    copied = chrdevbase_copy_from_iter(fifo->data, fifo->mask + 1, fifo->in & fifo->mask, len, from);
+    if (copied == 0)
+    {
+        return -EFAULT;
+    }
+
+    smp_wmb();
+    fifo->in += copied;
+    return copied;
+}
+
+/*
+描述：更换fifo的缓冲区，数据按顺序拷贝到新缓冲区的开头，调用者持有dev->lock
+      实例的fifo和写回暂存区共用
+参数：fifo：dev->fifo或dev->staging
+      size：新的大小，2的幂，不小于fifo中已有的数据量
+      gfp：分配标志
+return：true成功；false分配失败，fifo不变
+*/
+static bool chrdevbase_fifo_resize(struct kfifo *fifo, unsigned int size, gfp_t gfp)
+{
+    unsigned char *data;
+    unsigned int len;
+
+    data = kmalloc(size, gfp);
+    if (data == NULL)
+    {
+        return false;
+    }
+
+    len = kfifo_out(fifo, data, size);
+    kfree(fifo->kfifo.data);
+    kfifo_init(fifo, data, size);
+    fifo->kfifo.in = len;
+    return true;
+}
+
+/*
+描述：写者需要need字节的空间而fifo放不下时，在上限以内扩大fifo，扩大失败时保持原样，由调用者等待
+参数：dev：设备结构体
+      fifo：dev->fifo或dev->staging
+      need：需要的空闲字节数
+return：无
+*/
+static void chrdevbase_fifo_grow(struct chrdevbase_dev *dev, struct kfifo *fifo, size_t need)
+{
+    unsigned int len = kfifo_len(fifo);
+    unsigned int size;
+
+    if (kfifo_avail(fifo) >= need || kfifo_size(fifo) >= dev->fifo_cap)
+    {
+        return;
+    }
+
+    need = min_t(size_t, need, dev->fifo_cap);
+    size = min_t(unsigned int, roundup_pow_of_two(len + need), dev->fifo_cap);
+    if (chrdevbase_fifo_resize(fifo, size, GFP_KERNEL | __GFP_NOWARN))
+    {
+        chrdevbase_stat_inc(dev, fifo_grows);
+        dev->grow_failed = false;
+    }
+    else
+    {
+        dev->grow_failed = true; /*内存紧张，poll只按实际空闲的空间判断*/
+    }
+}
+
+/*
+描述：fifo可以缩小到的大小：能放下已有数据的最小的2的幂，不小于初始大小
+参数：dev：设备结构体
+      fifo：dev->fifo或dev->staging
+return：目标大小
+*/
+static unsigned int chrdevbase_fifo_target(struct chrdevbase_dev *dev, struct kfifo *fifo)
+{
+    return max_t(unsigned int, roundup_pow_of_two(max(kfifo_len(fifo), 1U)), dev->fifo_min);
+}
+
+/*
+描述：fifo超出目标大小、可以被shrinker释放的字节数
+参数：dev：设备结构体
+      fifo：dev->fifo或dev->staging
+return：字节数
+*/
+static unsigned int chrdevbase_fifo_excess(struct chrdevbase_dev *dev, struct kfifo *fifo)
+{
+    unsigned int size = kfifo_size(fifo);
+
+    return size - min(chrdevbase_fifo_target(dev, fifo), size);
+}
+
+/*
+描述：mmap模式下从环形缓冲区拷贝数据到iov_iter，调用者持有dev->lock
+参数：dev：设备结构体
+      to：目的iov_iter
+return：读取的字节数，负数表示失败
+*/
+static ssize_t chrdevbase_ring_read(struct chrdevbase_dev *dev, struct iov_iter *to)
+{
+    unsigned int tail = READ_ONCE(dev->hdr->tail);
+    unsigned int used = chrdevbase_ring_used(dev);
+    unsigned int len;
+    size_t copied;
+
+    if (used > dev->ring_size)
+    {
+        return -EIO; /*用户空间写坏了索引*/
+    }
+
+    len = min_t(size_t, iov_iter_count(to), used);
+    copied = chrdevbase_copy_to_iter(dev->ring_data, dev->ring_size, tail & (dev->ring_size - 1), len, to);
+    if (copied == 0)
+    {
+        return -EFAULT;
+    }
+
+    /*release保证数据读完以后生产者才能看到新的tail*/
+    smp_store_release(&dev->hdr->tail, tail + copied);
+    return copied;
+}
+
+/*
+描述：mmap模式下从iov_iter拷贝数据到环形缓冲区，调用者持有dev->lock
+参数：dev：设备结构体
+      from：源iov_iter
+return：写入的字节数，负数表示失败
+*/
+static ssize_t chrdevbase_ring_write(struct chrdevbase_dev *dev, struct iov_iter *from)
+{
+    unsigned int head = READ_ONCE(dev->hdr->head);
+    unsigned int used = head - smp_load_acquire(&dev->hdr->tail);
+    unsigned int len;
+    size_t copied;
+
+    if (used > dev->ring_size)
+    {
+        return -EIO;
+    }
+
+    len = min_t(size_t, iov_iter_count(from), dev->ring_size - used);
+    copied = chrdevbase_copy_from_iter(dev->ring_data, dev->ring_size, head & (dev->ring_size - 1), len, from);
+    if (copied == 0)
+    {
+        return -EFAULT;
+    }
+
+    /*release保证数据写完以后消费者才能看到新的head*/
+    smp_store_release(&dev->hdr->head, head + copied);
+    return copied;
+}
+
+/*
+描述：唤醒在环形缓冲区上等待的读者和写者，并清除等待标志
+参数：dev：设备结构体
+return：无
+*/
+static void chrdevbase_ring_wake(struct chrdevbase_dev *dev)
+{
+    unsigned int used = chrdevbase_ring_used(dev);
+
+    WRITE_ONCE(dev->hdr->consumer_waiting, 0);
+    WRITE_ONCE(dev->hdr->producer_waiting, 0);
+    wake_up_interruptible(&dev->r_wait);
+    wake_up_interruptible(&dev->w_wait);
+
+    /*通知注册了SIGIO的进程*/
+    if (used != 0)
+    {
+        kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+    }
+    if (used < dev->ring_size)
+    {
+        kill_fasync(&dev->async_queue, SIGIO, POLL_OUT);
+    }
+}
+
+/*
+描述：存储模式下从*ppos处读取数据，按页分块拷贝，未分配的页读出0
+      copy_page_to_iter直接从存储页拷贝到用户内存，只有一次拷贝，大块传输也不需要另外固定用户页
+参数：dev：设备结构体
+      to：目的iov_iter
+      ppos：读取位置，成功后向后移动
+return：读取的字节数，到达末尾时返回0；负数表示失败
+*/
+static ssize_t chrdevbase_store_read(struct chrdevbase_dev *dev, struct iov_iter *to, loff_t *ppos)
+{
+    loff_t pos = *ppos;
+    size_t count, total = 0;
+
+    if (pos < 0)
+    {
+        return -EINVAL;
+    }
+    if (pos >= dev->store_size)
+    {
+        return 0;
+    }
+    count = min_t(loff_t, iov_iter_count(to), dev->store_size - pos);
+
+    if (mutex_lock_interruptible(&dev->lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    while (total < count)
+    {
+        struct page *page = dev->pages[pos >> PAGE_SHIFT];
+        size_t offset = pos & ~PAGE_MASK;
+        size_t chunk = min_t(size_t, PAGE_SIZE - offset, count - total);
+        size_t copied;
+
+        /*每次最多拷贝到当前页的末尾*/
+        if (page != NULL)
+        {
+            copied = copy_page_to_iter(page, offset, chunk, to);
+        }
+        else
+        {
+            copied = iov_iter_zero(chunk, to);
+        }
+
+        total += copied;
+        pos += copied;
+        if (copied < chunk)
+        {
+            break; /*用户空间缓冲区无效*/
+        }
+    }
+
+    mutex_unlock(&dev->lock);
+
+    if (total == 0)
+    {
+        return -EFAULT;
+    }
+    *ppos = pos;
+    return total;
+}
+
+/*
+描述：存储模式下向*ppos处写入数据，按页分块拷贝，第一次写到某一页时才分配这一页
+      copy_page_from_iter直接从用户内存拷贝到存储页，只有一次拷贝，大块传输也不需要另外固定用户页
+参数：dev：设备结构体
+      from：源iov_iter
+      ppos：写入位置，成功后向后移动
+return：写入的字节数；负数表示失败，超出容量时返回-ENOSPC
+*/
+static ssize_t chrdevbase_store_write(struct chrdevbase_dev *dev, struct iov_iter *from, loff_t *ppos)
+{
+    loff_t pos = *ppos;
+    size_t count, total = 0;
+    ssize_t retvalue = 0;
+
+    if (pos < 0)
+    {
+        return -EINVAL;
+    }
+    if (pos >= dev->store_size)
+    {
+        return -ENOSPC;
+    }
+    count = min_t(loff_t, iov_iter_count(from), dev->store_size - pos);
+
+    if (mutex_lock_interruptible(&dev->lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    while (total < count)
+    {
+        struct page **slot = &dev->pages[pos >> PAGE_SHIFT];
+        size_t offset = pos & ~PAGE_MASK;
+        size_t chunk = min_t(size_t, PAGE_SIZE - offset, count - total);
+        size_t copied;
+
+        if (*slot == NULL)
+        {
+            /*清零分配，页中没有写到的部分读出来为0*/
+            *slot = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+            if (*slot == NULL)
+            {
+                retvalue = -ENOMEM;
+                break;
+            }
+            dev->store_pages++;
+        }
+
+        copied = copy_page_from_iter(*slot, offset, chunk, from);
+        total += copied;
+        pos += copied;
+        if (copied < chunk)
+        {
+            retvalue = -EFAULT;
+            break;
+        }
+    }
+
+    mutex_unlock(&dev->lock);
+
+    /*已经写入了一部分数据时返回写入的字节数*/
+    if (total == 0)
+    {
+        return retvalue;
+    }
+    *ppos = pos;
+    return total;
+}
+
+/*
+描述：存储模式下的lseek，位置不能超出容量
+参数：filp：设备文件，file结构体指针
+      offset：偏移
+      whence：SEEK_SET/SEEK_CUR/SEEK_END
+return：新的位置，负数表示失败
+*/
+static loff_t chrdevbase_llseek(struct file *filp, loff_t offset, int whence)
+{
+    struct chrdevbase_ctx *ctx = filp->private_data;
+    struct chrdevbase_dev *dev = ctx->dev;
+
+    if (dev->mode != CHRDEVBASE_MODE_STORE)
+    {
+        return -ESPIPE;
+    }
+    return fixed_size_llseek(filp, offset, whence, dev->store_size);
+}
+
+/*
+描述：写回模式下把暂存区中的数据尽量搬到fifo中，每次搬运一段连续的数据，调用者持有dev->lock
+参数：dev：设备结构体
+return：搬运的字节数
+*/
+static unsigned int chrdevbase_wb_drain(struct chrdevbase_dev *dev)
+{
+    struct __kfifo *st = &dev->staging.kfifo;
+    unsigned int moved = 0, n;
+
+    chrdevbase_fifo_grow(dev, &dev->fifo, kfifo_len(&dev->staging));
+    while (!kfifo_is_empty(&dev->staging) && !kfifo_is_full(&dev->fifo))
+    {
+        /*暂存区中回绕前的一段，受fifo剩余空间限制*/
+        n = min_t(unsigned int, kfifo_len(&dev->staging), st->mask + 1 - (st->out & st->mask));
+        n = min_t(unsigned int, n, kfifo_avail(&dev->fifo));
+        kfifo_in(&dev->fifo, (char *)st->data + (st->out & st->mask), n);
+        st->out += n;
+        moved += n;
+    }
+
+    if (moved != 0)
+    {
+        chrdevbase_stat_inc(dev, wb_batches);
+        chrdevbase_stat_add(dev, wb_bytes, moved);
+    }
+    return moved;
+}
+
+/*
+描述：写回模式下搬运一次暂存区，有数据搬运时唤醒读者和等待暂存区空间的写者
+参数：dev：设备结构体
+return：true暂存区已经为空；false fifo已满，还有数据留在暂存区
+*/
+static bool chrdevbase_wb_flush(struct chrdevbase_dev *dev)
+{
+    unsigned int moved;
+    bool empty;
+
+    mutex_lock(&dev->lock);
+    moved = chrdevbase_wb_drain(dev);
+    empty = kfifo_is_empty(&dev->staging);
+    mutex_unlock(&dev->lock);
+
+    if (moved != 0)
+    {
+        wake_up_interruptible(&dev->r_wait);
+        wake_up_interruptible(&dev->w_wait);
+        kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+        kill_fasync(&dev->async_queue, SIGIO, POLL_OUT);
+    }
+    return empty;
+}
+
+/*
+描述：写回的延迟工作，fifo满时剩下的数据等读者腾出空间后再次调度
+参数：work：dev->wb_work
+return：无
+*/
+static void chrdevbase_wb_work(struct work_struct *work)
+{
+    struct chrdevbase_dev *dev = container_of(to_delayed_work(work), struct chrdevbase_dev, wb_work);
+
+    chrdevbase_wb_flush(dev);
+}
+
+/*
+描述：写回模式下写入暂存区以后调度搬运，积累了半个暂存区时立即搬运
+参数：dev：设备结构体
+return：无
+*/
+static void chrdevbase_wb_schedule(struct chrdevbase_dev *dev)
+{
+    if (kfifo_len(&dev->staging) >= kfifo_size(&dev->staging) / 2)
+    {
+        mod_delayed_work(system_wq, &dev->wb_work, 0);
+    }
+    else
+    {
+        schedule_delayed_work(&dev->wb_work, msecs_to_jiffies(writeback_ms)); /*已经在等待时不重复调度*/
+    }
+}
+
+/*
+描述：从设备读取数据到iov_iter，缓冲区为空时休眠，直到有写者写入数据
+      read/readv和splice共用这个函数
+参数：dev：设备结构体
+      to：目的iov_iter
+      nonblock：true表示以O_NONBLOCK方式打开，缓冲区为空时直接返回-EAGAIN
+return：读取的字节数，可能小于iov_iter的长度；如果为负数，表示读取失败
+*/
+static ssize_t chrdevbase_do_read(struct chrdevbase_dev *dev, struct iov_iter *to, bool nonblock)
+{
+    ssize_t retvalue = 0;
+
+    if (mutex_lock_interruptible(&dev->lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    /*缓冲区为空，释放锁后进入休眠，等待写者唤醒*/
+    while (!chrdevbase_readable(dev))
+    {
+        mutex_unlock(&dev->lock);
+        if (nonblock)
+        {
+            return -EAGAIN; /*非阻塞访问，不休眠*/
+        }
+        chrdevbase_stat_inc(dev, blocked_waits);
+
+        if (wait_event_interruptible(dev->r_wait, chrdevbase_readable(dev)))
+        {
+            return -ERESTARTSYS; /*被信号打断*/
+        }
+
+        if (mutex_lock_interruptible(&dev->lock))
+        {
+            return -ERESTARTSYS;
+        }
+    }
+
+    if (dev->mode == CHRDEVBASE_MODE_MMAP)
+    {
+        retvalue = chrdevbase_ring_read(dev, to);
+    }
+    else
+    {
+        retvalue = chrdevbase_fifo_read(&dev->fifo, to);
+    }
+    if (retvalue > 0)
+    {
+        dev->grow_failed = false; /*腾出了空间，写者可以再尝试扩大*/
+    }
+    mutex_unlock(&dev->lock);
+
+    if (retvalue <= 0)
+    {
+        return retvalue;
+    }
+
+    /*缓冲区腾出了空间，唤醒等待的写者*/
+    if (dev->mode == CHRDEVBASE_MODE_MMAP)
+    {
+        chrdevbase_ring_wake(dev);
+    }
+    else if (dev->writeback)
+    {
+        /*fifo腾出了空间，立即搬运暂存区中剩下的数据，写者由搬运唤醒*/
+        if (!kfifo_is_empty(&dev->staging))
+        {
+            mod_delayed_work(system_wq, &dev->wb_work, 0);
+        }
+        wake_up_interruptible(&dev->w_wait); /*唤醒在fsync中等待的进程*/
+    }
+    else
+    {
+        wake_up_interruptible(&dev->w_wait);
+        kill_fasync(&dev->async_queue, SIGIO, POLL_OUT);
+    }
+    return retvalue;
+}
+
+/*
+描述：从iov_iter写入数据到设备，缓冲区已满时休眠，直到读者取走数据
+      write/writev和splice共用这个函数，writev的多个缓冲区在一次加锁内写入
+参数：dev：设备结构体
+      from：源iov_iter
+      nonblock：true表示以O_NONBLOCK方式打开，缓冲区已满时直接返回-EAGAIN
+return：写入的字节数，可能小于iov_iter的长度；如果为负数，表示写入失败
+*/
+static ssize_t chrdevbase_do_write(struct chrdevbase_dev *dev, struct iov_iter *from, bool nonblock)
+{
+    ssize_t retvalue = 0;
+
+    if (mutex_lock_interruptible(&dev->lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    /*放不下时先在上限以内扩大fifo，写回模式下扩大暂存区，fifo由搬运时扩大*/
+    if (dev->mode == CHRDEVBASE_MODE_PIPE)
+    {
+        chrdevbase_fifo_grow(dev, dev->writeback ? &dev->staging : &dev->fifo, iov_iter_count(from));
+    }
+
+    /*缓冲区已满，释放锁后进入休眠，等待读者唤醒*/
+    while (!chrdevbase_writable(dev))
+    {
+        mutex_unlock(&dev->lock);
+        if (nonblock)
+        {
+            return -EAGAIN; /*非阻塞访问，不休眠*/
+        }
+        chrdevbase_stat_inc(dev, blocked_waits);
+
+        if (wait_event_interruptible(dev->w_wait, chrdevbase_writable(dev)))
+        {
+            return -ERESTARTSYS;
+        }
+
+        if (mutex_lock_interruptible(&dev->lock))
+        {
+            return -ERESTARTSYS;
+        }
+    }
+
+    if (dev->mode == CHRDEVBASE_MODE_MMAP)
+    {
+        retvalue = chrdevbase_ring_write(dev, from);
+    }
+    else if (dev->writeback)
+    {
+        retvalue = chrdevbase_fifo_write(&dev->staging, from);
+    }
+    else
+    {
+        retvalue = chrdevbase_fifo_write(&dev->fifo, from);
+    }
+    mutex_unlock(&dev->lock);
+
+    if (retvalue <= 0)
+    {
+        return retvalue;
+    }
+
+    /*缓冲区中有了新数据，唤醒等待的读者*/
+    if (dev->mode == CHRDEVBASE_MODE_MMAP)
+    {
+        chrdevbase_ring_wake(dev);
+    }
+    else if (dev->writeback)
+    {
+        chrdevbase_wb_schedule(dev); /*数据还在暂存区，读者要等搬运以后才能看到*/
+    }
+    else
+    {
+        wake_up_interruptible(&dev->r_wait);
+        kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+    }
+    return retvalue;
+}
+
+/*
+描述：私有模式下从上下文的fifo读取数据，为空时休眠，直到共享这个文件描述符的其他线程写入数据
+参数：ctx：上下文
+      to：目的iov_iter
+      nonblock：true表示为空时直接返回-EAGAIN
+return：读取的字节数；负数表示失败
+*/
+static ssize_t chrdevbase_ctx_read(struct chrdevbase_ctx *ctx, struct iov_iter *to, bool nonblock)
+{
+    ssize_t retvalue = 0;
+
+    if (mutex_lock_interruptible(&ctx->lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    while (kfifo_is_empty(&ctx->fifo))
+    {
+        mutex_unlock(&ctx->lock);
+        if (nonblock)
+        {
+            return -EAGAIN;
+        }
+        chrdevbase_stat_inc(ctx->dev, blocked_waits);
+
+        if (wait_event_interruptible(ctx->r_wait, !kfifo_is_empty(&ctx->fifo)))
+        {
+            return -ERESTARTSYS;
+        }
+
+        if (mutex_lock_interruptible(&ctx->lock))
+        {
+            return -ERESTARTSYS;
+        }
+    }
+
+    retvalue = chrdevbase_fifo_read(&ctx->fifo, to);
+    mutex_unlock(&ctx->lock);
+
+    if (retvalue > 0)
+    {
+        wake_up_interruptible(&ctx->w_wait);
+        kill_fasync(&ctx->async_queue, SIGIO, POLL_OUT);
+    }
+    return retvalue;
+}
+
+/*
+描述：私有模式下向上下文的fifo写入数据，已满时休眠，直到数据被读走
+参数：ctx：上下文
+      from：源iov_iter
+      nonblock：true表示已满时直接返回-EAGAIN
+return：写入的字节数；负数表示失败
+*/
+static ssize_t chrdevbase_ctx_write(struct chrdevbase_ctx *ctx, struct iov_iter *from, bool nonblock)
+{
+    ssize_t retvalue = 0;
+
+    if (mutex_lock_interruptible(&ctx->lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    while (kfifo_is_full(&ctx->fifo))
+    {
+        mutex_unlock(&ctx->lock);
+        if (nonblock)
+        {
+            return -EAGAIN;
+        }
+        chrdevbase_stat_inc(ctx->dev, blocked_waits);
+
+        if (wait_event_interruptible(ctx->w_wait, !kfifo_is_full(&ctx->fifo)))
+        {
+            return -ERESTARTSYS;
+        }
+
+        if (mutex_lock_interruptible(&ctx->lock))
+        {
+            return -ERESTARTSYS;
+        }
+    }
+
+    retvalue = chrdevbase_fifo_write(&ctx->fifo, from);
+    mutex_unlock(&ctx->lock);
+
+    if (retvalue > 0)
+    {
+        wake_up_interruptible(&ctx->r_wait);
+        kill_fasync(&ctx->async_queue, SIGIO, POLL_IN);
+    }
+    return retvalue;
+}
+
+/*
+描述：广播模式下从缓冲区的pos处取出len个字节，跨过缓冲区末尾时分两段，调用者持有dev->lock
+参数：dev：设备结构体
+      pos：位置，自由增长，对缓冲区大小取模
+      buf：目的地址
+      len：字节数
+return：无
+*/
+static void chrdevbase_bcast_get(struct chrdevbase_dev *dev, u64 pos, void *buf, unsigned int len)
+{
+    unsigned int off = pos & (dev->bcast_size - 1);
+    unsigned int first = min(len, dev->bcast_size - off);
+
+    memcpy(buf, dev->bcast + off, first);
+    memcpy((char *)buf + first, dev->bcast, len - first);
+}
+
+/*
+描述：广播模式下把len个字节放到缓冲区的pos处，调用者持有dev->lock
+参数：dev：设备结构体
+      pos：位置
+      buf：源地址
+      len：字节数
+return：无
+*/
+static void chrdevbase_bcast_put(struct chrdevbase_dev *dev, u64 pos, const void *buf, unsigned int len)
+{
+    unsigned int off = pos & (dev->bcast_size - 1);
+    unsigned int first = min(len, dev->bcast_size - off);
+
+    memcpy(dev->bcast + off, buf, first);
+    memcpy(dev->bcast, (const char *)buf + first, len - first);
+}
+
+/*
+描述：广播模式下该读者是否有新消息，不加锁读取head，32位系统上读到的值可能不完整，持锁后会再检查一次
+参数：ctx：上下文
+return：true有消息可读；false没有
+*/
+static bool chrdevbase_bcast_readable(struct chrdevbase_ctx *ctx)
+{
+    return ctx->cursor != READ_ONCE(ctx->dev->bcast_head);
+}
+
+/*
+描述：广播模式下读取本文件描述符的下一条消息，没有新消息时休眠
+      读者落后太多时游标处的消息已被写者覆盖，游标跳到最旧的消息，并根据overrun_error决定是否报告
+      调用者的缓冲区小于消息时，多出的部分被丢弃，与数据报套接字一致
+参数：ctx：上下文
+      to：目的iov_iter
+      nonblock：true表示没有新消息时直接返回-EAGAIN
+return：读取的字节数；-EPIPE表示发生了溢出，再次读取会从最旧的消息继续；其他负数表示失败
+*/
+static ssize_t chrdevbase_bcast_read(struct chrdevbase_ctx *ctx, struct iov_iter *to, bool nonblock)
+{
+    struct chrdevbase_dev *dev = ctx->dev;
+    u32 len;
+    size_t copied;
+
+    if (mutex_lock_interruptible(&dev->lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    while (!chrdevbase_bcast_readable(ctx))
+    {
+        mutex_unlock(&dev->lock);
+        if (nonblock)
+        {
+            return -EAGAIN;
+        }
+        chrdevbase_stat_inc(dev, blocked_waits);
+
+        if (wait_event_interruptible(dev->r_wait, chrdevbase_bcast_readable(ctx)))
+        {
+            return -ERESTARTSYS;
+        }
+
+        if (mutex_lock_interruptible(&dev->lock))
+        {
+            return -ERESTARTSYS;
+        }
+    }
+
+    /*游标处的消息已经被覆盖，跳到仍然有效的最旧的消息*/
+    if (ctx->cursor < dev->bcast_tail)
+    {
+        ctx->cursor = dev->bcast_tail;
+        chrdevbase_stat_inc(dev, overruns);
+        if (overrun_error)
+        {
+            mutex_unlock(&dev->lock);
+            return -EPIPE;
+        }
+    }
+
+    chrdevbase_bcast_get(dev, ctx->cursor, &len, sizeof(len));
+    copied = chrdevbase_copy_to_iter(dev->bcast, dev->bcast_size, (ctx->cursor + sizeof(len)) & (dev->bcast_size - 1),
+                                     min_t(size_t, len, iov_iter_count(to)), to);
+    if (copied == 0)
+    {
+        mutex_unlock(&dev->lock);
+        return -EFAULT; /*游标不动，下次重新读这条消息*/
+    }
+    ctx->cursor += sizeof(len) + len;
+    mutex_unlock(&dev->lock);
+    return copied;
+}
+
+/*
+描述：广播模式下写入一条消息，写者从不等待读者，空间不够时覆盖最旧的消息
+参数：dev：设备结构体
+      from：源iov_iter，整个iov_iter为一条消息
+return：写入的字节数；-EMSGSIZE表示消息比缓冲区大；其他负数表示失败
+*/
+static ssize_t chrdevbase_bcast_write(struct chrdevbase_dev *dev, struct iov_iter *from)
+{
+    size_t count = iov_iter_count(from);
+    u32 len, old;
+
+    if (count > dev->bcast_size - sizeof(len))
+    {
+        return -EMSGSIZE;
+    }
+    len = count;
+
+    if (mutex_lock_interruptible(&dev->lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    /*丢弃最旧的消息，直到放得下新消息，游标还停在这些消息上的读者下次读取时会发现溢出*/
+    while (dev->bcast_head + sizeof(len) + len - dev->bcast_tail > dev->bcast_size)
+    {
+        chrdevbase_bcast_get(dev, dev->bcast_tail, &old, sizeof(old));
+        dev->bcast_tail += sizeof(old) + old;
+    }
+
+    chrdevbase_bcast_put(dev, dev->bcast_head, &len, sizeof(len));
+    if (chrdevbase_copy_from_iter(dev->bcast, dev->bcast_size, (dev->bcast_head + sizeof(len)) & (dev->bcast_size - 1),
+                                  len, from) != len)
+    {
+        mutex_unlock(&dev->lock);
+        return -EFAULT; /*head不动，这条消息不会被读到*/
+    }
+    WRITE_ONCE(dev->bcast_head, dev->bcast_head + sizeof(len) + len);
+    mutex_unlock(&dev->lock);
+
+    /*所有读者都有了新消息*/
+    wake_up_interruptible(&dev->r_wait);
+    kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+    return len;
+}
+
+/*
+描述：分帧模式下读取记录，为空时休眠；一次读取返回调用者缓冲区中能放下的所有完整记录
+      返回给用户空间的每条记录都带有4字节的长度头，格式与缓冲区中的相同，用户空间按长度头依次拆分
+参数：dev：设备结构体
+      to：目的iov_iter
+      nonblock：true表示为空时直接返回-EAGAIN
+return：读取的字节数，包括记录头；-EMSGSIZE表示第一条记录放不下，记录不会被取走；其他负数表示失败
+*/
+static ssize_t chrdevbase_frame_read(struct chrdevbase_dev *dev, struct iov_iter *to, bool nonblock)
+{
+    struct __kfifo *fifo = &dev->fifo.kfifo;
+    unsigned int records = 0;
+    ssize_t retvalue = 0;
+    u32 len;
+
+    if (mutex_lock_interruptible(&dev->lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    while (kfifo_is_empty(&dev->fifo))
+    {
+        mutex_unlock(&dev->lock);
+        if (nonblock)
+        {
+            return -EAGAIN;
+        }
+        chrdevbase_stat_inc(dev, blocked_waits);
+
+        if (wait_event_interruptible(dev->r_wait, !kfifo_is_empty(&dev->fifo)))
+        {
+            return -ERESTARTSYS;
+        }
+
+        if (mutex_lock_interruptible(&dev->lock))
+        {
+            return -ERESTARTSYS;
+        }
+    }
+
+    /*写者在持锁时写入完整的记录，缓冲区中总是整数条记录*/
+    while (!kfifo_is_empty(&dev->fifo))
+    {
+        kfifo_out_peek(&dev->fifo, &len, sizeof(len));
+        if (sizeof(len) + len > iov_iter_count(to))
+        {
+            break; /*剩下的记录留给下一次读取*/
+        }
+        if (copy_to_iter(&len, sizeof(len), to) != sizeof(len) ||
+            chrdevbase_copy_to_iter(fifo->data, fifo->mask + 1, (fifo->out + sizeof(len)) & fifo->mask, len, to) != len)
+        {
+            if (retvalue == 0)
+            {
+                retvalue = -EFAULT;
+            }
+            break;
+        }
+        fifo->out += sizeof(len) + len;
+        retvalue += sizeof(len) + len;
+        records++;
+    }
+    if (retvalue == 0)
+    {
+        retvalue = -EMSGSIZE;
+    }
+    else
+    {
+        dev->grow_failed = false;
+    }
+    mutex_unlock(&dev->lock);
+
+    if (retvalue > 0)
+    {
+        chrdevbase_stat_add(dev, read_records, records);
+        wake_up_interruptible(&dev->w_wait);
+        kill_fasync(&dev->async_queue, SIGIO, POLL_OUT);
+    }
+    return retvalue;
+}
+
+/*
+描述：分帧模式下写入一条记录，空间不够放下整条记录时休眠，记录不会被拆开
+      非阻塞写入返回-EAGAIN时记下这条记录需要的空间，poll据此判断本文件描述符是否可写
+参数：ctx：上下文
+      from：源iov_iter，整个iov_iter为一条记录
+      nonblock：true表示空间不够时直接返回-EAGAIN
+return：写入的字节数，不包括记录头；-EMSGSIZE表示记录比缓冲区大；其他负数表示失败
+*/
+static ssize_t chrdevbase_frame_write(struct chrdevbase_ctx *ctx, struct iov_iter *from, bool nonblock)
+{
+    struct chrdevbase_dev *dev = ctx->dev;
+    struct __kfifo *fifo = &dev->fifo.kfifo;
+    size_t count = iov_iter_count(from);
+    u32 len;
+
+    if (count > dev->fifo_cap - sizeof(len))
+    {
+        return -EMSGSIZE;
+    }
+    len = count;
+
+    if (mutex_lock_interruptible(&dev->lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    chrdevbase_fifo_grow(dev, &dev->fifo, sizeof(len) + len);
+    while (kfifo_avail(&dev->fifo) < sizeof(len) + len)
+    {
+        /*fifo扩大失败，整个缓冲区都放不下这条记录*/
+        if (kfifo_size(&dev->fifo) < sizeof(len) + len)
+        {
+            mutex_unlock(&dev->lock);
+            return -ENOMEM;
+        }
+        mutex_unlock(&dev->lock);
+        if (nonblock)
+        {
+            WRITE_ONCE(ctx->frame_need, sizeof(len) + len);
+            return -EAGAIN;
+        }
+        chrdevbase_stat_inc(dev, blocked_waits);
+
+        /*读者取走数据以后fifo可能被shrinker缩小过，醒来后重新扩大*/
+        if (wait_event_interruptible(dev->w_wait, kfifo_avail(&dev->fifo) >= sizeof(len) + len ||
+                                                  kfifo_size(&dev->fifo) < sizeof(len) + len))
+        {
+            return -ERESTARTSYS;
+        }
+
+        if (mutex_lock_interruptible(&dev->lock))
+        {
+            return -ERESTARTSYS;
+        }
+        chrdevbase_fifo_grow(dev, &dev->fifo, sizeof(len) + len);
+    }
+
+    /*先拷贝数据再写记录头，拷贝失败时in不动，读者看不到半条记录*/
+    if (chrdevbase_copy_from_iter(fifo->data, fifo->mask + 1, (fifo->in + sizeof(len)) & fifo->mask, len, from) != len)
+    {
+        mutex_unlock(&dev->lock);
+        return -EFAULT;
+    }
+    kfifo_in(&dev->fifo, &len, sizeof(len));
+    fifo->in += len;
+    mutex_unlock(&dev->lock);
+    WRITE_ONCE(ctx->frame_need, 0);
+
+    wake_up_interruptible(&dev->r_wait);
+    kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+    return len;
+}
+
+/*
+描述：计算耗时在延时直方图中的桶号
+参数：ns：耗时，单位纳秒
+return：桶号，fls64(ns)，超出范围时为最后一个桶
+*/
+static unsigned int chrdevbase_hist_bucket(u64 ns)
+{
+    return min_t(unsigned int, fls64(ns), CHRDEVBASE_HIST_BUCKETS - 1);
+}
+
+/*
+描述：根据工作模式从设备读取数据，read/readv和splice共用，并更新本文件描述符的统计信息
+参数：ctx：上下文
+      to：目的iov_iter
+      ppos：文件位置，只有存储模式使用
+      nonblock：true表示没有数据时直接返回-EAGAIN
+return：读取的字节数；负数表示失败
+*/
+static ssize_t chrdevbase_file_read(struct chrdevbase_ctx *ctx, struct iov_iter *to, loff_t *ppos, bool nonblock)
+{
+    ssize_t retvalue;
+
+    switch (ctx->dev->mode)
+    {
+    case CHRDEVBASE_MODE_STORE:
+        retvalue = chrdevbase_store_read(ctx->dev, to, ppos);
+        break;
+    case CHRDEVBASE_MODE_PRIVATE:
+        retvalue = chrdevbase_ctx_read(ctx, to, nonblock);
+        break;
+    case CHRDEVBASE_MODE_BROADCAST:
+        retvalue = chrdevbase_bcast_read(ctx, to, nonblock);
+        break;
+    case CHRDEVBASE_MODE_FRAMED:
+        retvalue = chrdevbase_frame_read(ctx->dev, to, nonblock);
+        break;
+    default:
+        retvalue = chrdevbase_do_read(ctx->dev, to, nonblock);
+        break;
+    }
+
+    /*同一个文件描述符被多个线程同时使用时，文件的计数可能不精确*/
+    if (retvalue > 0)
+    {
+        ctx->stats.read_ops++;
+        ctx->stats.read_bytes += retvalue;
+        chrdevbase_stat_inc(ctx->dev, read_ops);
+        chrdevbase_stat_add(ctx->dev, read_bytes, retvalue);
+        if (iov_iter_count(to) != 0)
+        {
+            chrdevbase_stat_inc(ctx->dev, short_reads); /*没有填满调用者的缓冲区*/
+        }
+    }
+    return retvalue;
+}
+
+/*
+描述：根据工作模式向设备写入数据，write/writev和splice共用，并更新本文件描述符的统计信息
+参数：ctx：上下文
+      from：源iov_iter
+      ppos：文件位置，只有存储模式使用
+      nonblock：true表示没有空间时直接返回-EAGAIN
+return：写入的字节数；负数表示失败
+*/
+static ssize_t chrdevbase_file_write(struct chrdevbase_ctx *ctx, struct iov_iter *from, loff_t *ppos, bool nonblock)
+{
+    ssize_t retvalue;
+
+    switch (ctx->dev->mode)
+    {
+    case CHRDEVBASE_MODE_STORE:
+        retvalue = chrdevbase_store_write(ctx->dev, from, ppos);
+        break;
+    case CHRDEVBASE_MODE_PRIVATE:
+        retvalue = chrdevbase_ctx_write(ctx, from, nonblock);
+        break;
+    case CHRDEVBASE_MODE_BROADCAST:
+        retvalue = chrdevbase_bcast_write(ctx->dev, from);
+        break;
+    case CHRDEVBASE_MODE_FRAMED:
+        retvalue = chrdevbase_frame_write(ctx, from, nonblock);
+        break;
+    default:
+        retvalue = chrdevbase_do_write(ctx->dev, from, nonblock);
+        break;
+    }
+
+    if (retvalue > 0)
+    {
+        ctx->stats.write_ops++;
+        ctx->stats.write_bytes += retvalue;
+        chrdevbase_stat_inc(ctx->dev, write_ops);
+        chrdevbase_stat_add(ctx->dev, write_bytes, retvalue);
+    }
+    return retvalue;
+}
+
+
+/*
+描述：打开设备
+参数：inode：传递给驱动的inode结构体指针
+      filp：设备文件，file结构体指针
+return：0成功；其他失败
+*/
+static int chrdevbase_open(struct inode *inode, struct file *filp)
+{
+    struct chrdevbase_ctx *ctx;
+    int retvalue = 0;
+
+    /*从slab缓存分配上下文，只清零结构体本身，私有缓冲区不需要清零*/
+    ctx = kmem_cache_alloc(chrdevbase_ctx_cache, GFP_KERNEL);
+    if (ctx == NULL)
+    {
+        trace_chrdevbase_open(iminor(inode), mode, filp->f_flags, -ENOMEM);
+        return -ENOMEM;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+
+    /*通过cdev找到次设备号对应的实例*/
+    ctx->dev = container_of(inode->i_cdev, struct chrdevbase_dev, cdev);
+    if (ctx->dev->mode == CHRDEVBASE_MODE_PRIVATE)
+    {
+        kfifo_init(&ctx->fifo, ctx->buf, chrdevbase_ctx_buf_size);
+        mutex_init(&ctx->lock);
+        init_waitqueue_head(&ctx->r_wait);
+        init_waitqueue_head(&ctx->w_wait);
+    }
+    else if (ctx->dev->mode == CHRDEVBASE_MODE_BROADCAST)
+    {
+        /*新的读者只接收open之后写入的消息*/
+        mutex_lock(&ctx->dev->lock);
+        ctx->cursor = ctx->dev->bcast_head;
+        mutex_unlock(&ctx->dev->lock);
+    }
+    filp->private_data = ctx; /*设置私有数据*/
+
+    /*存储区支持lseek和pread/pwrite，其他模式是数据流设备，不支持lseek*/
+    if (ctx->dev->mode != CHRDEVBASE_MODE_STORE)
+    {
+        retvalue = nonseekable_open(inode, filp);
+    }
+
+    trace_chrdevbase_open(ctx->dev->minor, ctx->dev->mode, filp->f_flags, retvalue);
+    return retvalue;
+}
+
+/*
+描述：从设备读取数据，read和readv都会调用这个函数
+参数: iocb: 本次I/O的控制块，iocb->ki_filp为要打开的设备文件
+      to: 返回给用户空间的数据缓冲区，readv时包含多个缓冲区
+return: 读取的字节数，可能小于请求的长度；如果为负数，表示读取失败
+*/
+static ssize_t chrdevbase_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    ssize_t retvalue = 0;
+    struct chrdevbase_ctx *ctx = iocb->ki_filp->private_data;
+    size_t count = iov_iter_count(to);
+    u64 start, ns;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    start = ktime_get_ns();
+    retvalue = chrdevbase_file_read(ctx, to, &iocb->ki_pos, iocb->ki_filp->f_flags & O_NONBLOCK);
+    ns = ktime_get_ns() - start;
+    chrdevbase_stat_inc(ctx->dev, read_hist[chrdevbase_hist_bucket(ns)]);
+    trace_chrdevbase_read(ctx->dev->minor, count, retvalue, ns);
+
+    /*每次操作都printk会在控制台锁上串行化，这里只限速打印真正的错误，非阻塞和被信号打断是正常情况*/
+    if (retvalue < 0 && retvalue != -EAGAIN && retvalue != -ERESTARTSYS)
+    {
+        printk_ratelimited(KERN_ERR "chardevbase minor %d send data to user space failed, ret = %zd\n", ctx->dev->minor, retvalue);
+    }
+    return retvalue;
+}
+
+/*
+描述：向设备写入数据，write和writev都会调用这个函数
+参数: iocb: 本次I/O的控制块，iocb->ki_filp为要打开的设备文件
+      from: 要写入的数据缓冲区，writev时包含多个缓冲区
+return: 写入的字节数，可能小于请求的长度；如果为负数，表示写入失败
+*/
+static ssize_t chrdevbase_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    ssize_t retvalue = 0;
+    struct chrdevbase_ctx *ctx = iocb->ki_filp->private_data;
+    size_t count = iov_iter_count(from);
+    u64 start, ns;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    start = ktime_get_ns();
+    retvalue = chrdevbase_file_write(ctx, from, &iocb->ki_pos, iocb->ki_filp->f_flags & O_NONBLOCK);
+    ns = ktime_get_ns() - start;
+    chrdevbase_stat_inc(ctx->dev, write_hist[chrdevbase_hist_bucket(ns)]);
+    trace_chrdevbase_write(ctx->dev->minor, count, retvalue, ns);
+
+    if (retvalue < 0 && retvalue != -EAGAIN && retvalue != -ERESTARTSYS)
+    {
+        printk_ratelimited(KERN_ERR "chardevbase minor %d recv data from user space failed, ret = %zd\n", ctx->dev->minor, retvalue);
+    }
+    return retvalue;
+}
+
+/*
+描述：释放splice_read分配的页
+参数：spd：splice描述符
+      i：页的序号
+return：无
+*/
+static void chrdevbase_spd_release(struct splice_pipe_desc *spd, unsigned int i)
+{
+    put_page(spd->pages[i]);
+}
+
+/*splice_read放入管道的页，由管道负责释放*/
+static const struct pipe_buf_operations chrdevbase_pipe_buf_ops = {
+    .can_merge = 0,
+    .confirm = generic_pipe_buf_confirm,
+    .release = generic_pipe_buf_release,
+    .steal = generic_pipe_buf_steal,
+    .get = generic_pipe_buf_get,
+};
+
+/*
+描述：等待管道中有空闲的缓冲区，返回空闲的个数，splice_read按这个数量从设备取数据
+      只保证检查时有空间，同一个管道上还有其他写者时仍然可能被抢先
+参数：pipe：目的管道
+      nonblock：true表示管道已满时直接返回-EAGAIN
+return：空闲缓冲区的个数；-EPIPE表示管道没有读者；-EAGAIN、-ERESTARTSYS
+*/
+static int chrdevbase_pipe_room(struct pipe_inode_info *pipe, bool nonblock)
+{
+    int room = 0;
+
+    pipe_lock(pipe);
+    while (room == 0)
+    {
+        if (!pipe->readers)
+        {
+            send_sig(SIGPIPE, current, 0);
+            room = -EPIPE;
+        }
+        else if (pipe->nrbufs < pipe->buffers)
+        {
+            room = pipe->buffers - pipe->nrbufs;
+        }
+        else if (nonblock)
+        {
+            room = -EAGAIN;
+        }
+        else if (signal_pending(current))
+        {
+            room = -ERESTARTSYS;
+        }
+        else
+        {
+            /*与splice_to_pipe一样在管道上等待读者腾出空间*/
+            pipe->waiting_writers++;
+            pipe_wait(pipe);
+            pipe->waiting_writers--;
+        }
+    }
+    pipe_unlock(pipe);
+    return room;
+}
+
+/*
+描述：splice，将设备中的数据直接放入管道，不经过用户空间缓冲区
+      数据从缓冲区拷贝到新分配的页后，这些页直接挂到管道上，之后可以再splice到socket或文件
+参数：in：设备文件
+      ppos：文件偏移，数据流设备不使用
+      pipe：目的管道
+      len：最多传输的字节数
+      flags：splice标志
+return：放入管道的字节数，负数表示失败
+*/
+static ssize_t chrdevbase_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags)
+{
+    struct chrdevbase_ctx *ctx = in->private_data;
+    struct page *pages[PIPE_DEF_BUFFERS];
+    struct partial_page partial[PIPE_DEF_BUFFERS];
+    struct kvec vec[PIPE_DEF_BUFFERS];
+    struct splice_pipe_desc spd = {
+        .pages = pages,
+        .partial = partial,
+        .nr_pages_max = PIPE_DEF_BUFFERS,
+        .flags = flags,
+        .ops = &chrdevbase_pipe_buf_ops,
+        .spd_release = chrdevbase_spd_release,
+    };
+    struct iov_iter to;
+    unsigned int nr_pages, i;
+    int room;
+    ssize_t retvalue;
+    bool nonblock = (flags & SPLICE_F_NONBLOCK) || (in->f_flags & O_NONBLOCK);
+
+    /*
+    数据从设备取出以后就不能再放回去，必须先确认管道放得下
+    管道放不进去的页会被splice_to_pipe释放，里面的数据就丢了
+    */
+    room = chrdevbase_pipe_room(pipe, nonblock);
+    if (room < 0)
+    {
+        return room;
+    }
+
+    /*一次最多填满管道中空闲的缓冲区，且不超过默认的缓冲区个数*/
+    len = min_t(size_t, len, min_t(unsigned int, room, PIPE_DEF_BUFFERS) * PAGE_SIZE);
+    nr_pages = DIV_ROUND_UP(len, PAGE_SIZE);
+    if (nr_pages == 0)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < nr_pages; i++)
+    {
+        pages[i] = alloc_page(GFP_KERNEL);
+        if (pages[i] == NULL)
+        {
+            break;
+        }
+        vec[i].iov_base = page_address(pages[i]);
+        vec[i].iov_len = min_t(size_t, len - i * PAGE_SIZE, PAGE_SIZE);
+    }
+    if (i == 0)
+    {
+        return -ENOMEM;
+    }
+    nr_pages = i;
+    len = min_t(size_t, len, nr_pages * PAGE_SIZE);
+
+    /*用内核页构造iov_iter，与read共用同一条拷贝路径*/
+    iov_iter_kvec(&to, ITER_KVEC | READ, vec, nr_pages, len);
+    retvalue = chrdevbase_file_read(ctx, &to, ppos, nonblock);
+    if (retvalue <= 0)
+    {
+        for (i = 0; i < nr_pages; i++)
+        {
+            put_page(pages[i]);
+        }
+        return retvalue;
+    }
+
+    /*只把装有数据的页交给管道，多余的页释放掉*/
+    spd.nr_pages = DIV_ROUND_UP(retvalue, PAGE_SIZE);
+    for (i = 0; i < spd.nr_pages; i++)
+    {
+        partial[i].offset = 0;
+        partial[i].len = min_t(size_t, retvalue - i * PAGE_SIZE, PAGE_SIZE);
+        partial[i].private = 0;
+    }
+    for (i = spd.nr_pages; i < nr_pages; i++)
+    {
+        put_page(pages[i]);
+    }
+
+    return splice_to_pipe(pipe, &spd);
+}
+
+/*
+描述：poll/select/epoll查询设备状态
+参数：filp：设备文件，file结构体指针
+      wait：等待列表
+return：POLLIN表示可读，POLLOUT表示可写
+*/
+static unsigned int chrdevbase_poll(struct file *filp, struct poll_table_struct *wait)
+{
+    unsigned int mask = 0;
+    struct chrdevbase_ctx *ctx = filp->private_data;
+    struct chrdevbase_dev *dev = ctx->dev;
+
+    /*私有模式只关心本文件描述符自己的fifo*/
+    if (dev->mode == CHRDEVBASE_MODE_PRIVATE)
+    {
+        poll_wait(filp, &ctx->r_wait, wait);
+        poll_wait(filp, &ctx->w_wait, wait);
+
+        if (!kfifo_is_empty(&ctx->fifo))
+        {
+            mask |= POLLIN | POLLRDNORM;
+        }
+        if (!kfifo_is_full(&ctx->fifo))
+        {
+            mask |= POLLOUT | POLLWRNORM;
+        }
+        return mask;
+    }
+
+    /*广播模式总是可写，是否可读取决于本文件描述符的游标*/
+    if (dev->mode == CHRDEVBASE_MODE_BROADCAST)
+    {
+        poll_wait(filp, &dev->r_wait, wait);
+
+        mask = POLLOUT | POLLWRNORM;
+        if (chrdevbase_bcast_readable(ctx))
+        {
+            mask |= POLLIN | POLLRDNORM;
+        }
+        if (overrun_error && ctx->cursor < READ_ONCE(dev->bcast_tail))
+        {
+            mask |= POLLERR; /*下一次读取会返回-EPIPE*/
+        }
+        return mask;
+    }
+
+    /*将读写等待队列添加到poll_table中*/
+    poll_wait(filp, &dev->r_wait, wait);
+    poll_wait(filp, &dev->w_wait, wait);
+
+    if (chrdevbase_readable(dev))
+    {
+        mask |= POLLIN | POLLRDNORM; /*有数据可读*/
+    }
+    if (dev->mode == CHRDEVBASE_MODE_FRAMED)
+    {
+        /*
+        只有放得下本文件描述符上一次没写进去的那条记录时才报告可写（fifo可以扩大到上限的也算，扩大失败过时不算），
+        否则水平触发的epoll写者会一直被唤醒，而write一直返回-EAGAIN；没有失败过时按最短的记录判断
+        */
+        u32 need = max_t(u32, READ_ONCE(ctx->frame_need), sizeof(u32) + 1);
+
+        if (kfifo_avail(&dev->fifo) >= need || (!READ_ONCE(dev->grow_failed) && kfifo_len(&dev->fifo) + need <= dev->fifo_cap))
+        {
+            mask |= POLLOUT | POLLWRNORM;
+        }
+    }
+    else if (chrdevbase_writable(dev) ||
+             (dev->fifo_cap != 0 && !READ_ONCE(dev->grow_failed) && kfifo_size(dev->writeback ? &dev->staging : &dev->fifo) < dev->fifo_cap))
+    {
+        mask |= POLLOUT | POLLWRNORM; /*有空间可写，或者fifo还可以扩大（上一次扩大没有失败）*/
+    }
+    return mask;
+}
+
+/*
+描述：ioctl，获取本文件描述符的统计信息；mmap模式下还用于等待和唤醒
+参数：filp：设备文件，file结构体指针
+      cmd：命令
+      arg：参数
+return：0成功；其他失败
+*/
+static long chrdevbase_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct chrdevbase_ctx *ctx = filp->private_data;
+    struct chrdevbase_dev *dev = ctx->dev;
+
+    if (cmd == CHRDEVBASE_IOC_GET_STATS)
+    {
+        if (copy_to_user((void __user *)arg, &ctx->stats, sizeof(ctx->stats)))
+        {
+            return -EFAULT;
+        }
+        return 0;
+    }
+
+    if (dev->mode != CHRDEVBASE_MODE_MMAP)
+    {
+        return -ENOTTY;
+    }
 
+    switch (cmd)
+    {
+    case CHRDEVBASE_IOC_WAIT_DATA: /*消费者没有数据可读，休眠等待生产者*/
+        if (filp->f_flags & O_NONBLOCK)
+        {
+            return chrdevbase_readable(dev) ? 0 : -EAGAIN;
+        }
+        chrdevbase_stat_inc(dev, blocked_waits);
+        if (wait_event_interruptible(dev->r_wait, chrdevbase_readable(dev)))
+        {
+            return -ERESTARTSYS;
+        }
+        break;
+    case CHRDEVBASE_IOC_WAIT_SPACE: /*生产者没有空间可写，休眠等待消费者*/
+        if (filp->f_flags & O_NONBLOCK)
+        {
+            return chrdevbase_writable(dev) ? 0 : -EAGAIN;
+        }
+        chrdevbase_stat_inc(dev, blocked_waits);
+        if (wait_event_interruptible(dev->w_wait, chrdevbase_writable(dev)))
+        {
+            return -ERESTARTSYS;
+        }
+        break;
+    case CHRDEVBASE_IOC_WAKE: /*用户空间更新了head或tail*/
+        chrdevbase_ring_wake(dev);
+        break;
+    default:
+        return -ENOTTY;
+    }
+    return 0;
+}
 
 /*
-描述：打开设备
-参数：inode：传递给驱动的inode结构体指针
-      filp：设备文件，file结构体指针
+描述：将共享环形缓冲区（头部页+数据区）映射到用户空间
+参数：filp：设备文件，file结构体指针
+      vma：用户空间的虚拟内存区域
 return：0成功；其他失败
 */
-static int chrdevbase_open(struct inode *inode, struct file *filp)
+static int chrdevbase_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-    //printk("chardevbase open\n");
-    return 0;
+    struct chrdevbase_ctx *ctx = filp->private_data;
+    struct chrdevbase_dev *dev = ctx->dev;
+
+    if (dev->mode != CHRDEVBASE_MODE_MMAP)
+    {
+        return -ENODEV;
+    }
+
+    /*remap_vmalloc_range会检查映射长度不超过分配的大小*/
+    return remap_vmalloc_range(vma, dev->ring, vma->vm_pgoff);
 }
 
 /*
-描述：从设备读取数据
-参数: filp: 要打开的设备文件
-      buf: 返回给用户空间的数据缓冲区
-      cnt: 要读取的数据长度
-      offt: 相对于文件首地址的偏移
-return: 读取的字节数，如果为负数，表示读取失败
+描述：fcntl(F_SETFL, FASYNC)时调用，登记或注销接收SIGIO的文件
+参数：fd：文件描述符
+      filp：设备文件，file结构体指针
+      on：非0登记，0注销
+return：大于等于0成功；负数失败
 */
-static ssize_t chrdevbase_read(struct file *filp, char __user *buf, size_t cnt, loff_t *offt)
+static int chrdevbase_fasync(int fd, struct file *filp, int on)
 {
-    int retvalue = 0;
+    struct chrdevbase_ctx *ctx = filp->private_data;
 
-    /*向用户空间发送数据*/
-    //先将内核空间的数据拷贝到readbuf中
-    memcpy(readbuf, kerneldata, sizeof(kerneldata));
+    if (ctx->dev->mode == CHRDEVBASE_MODE_PRIVATE)
+    {
+        return fasync_helper(fd, filp, on, &ctx->async_queue);
+    }
+    return fasync_helper(fd, filp, on, &ctx->dev->async_queue);
+}
 
-    //内核空间不能直接操作用户空间的内存，需要使用copy_to_user函数，将readbuf中的数据拷贝到buf中
-    retvalue = copy_to_user(buf, readbuf, cnt);
+/*
+描述：fsync，写回模式下等待暂存区中的数据全部对读者可见，fifo已满时等读者腾出空间
+参数：filp：设备文件，file结构体指针
+      start、end、datasync：未使用
+return：0成功；-EAGAIN表示O_NONBLOCK时fifo已满；其他负数失败
+*/
+static int chrdevbase_fsync(struct file *filp, loff_t start, loff_t end, int datasync)
+{
+    struct chrdevbase_ctx *ctx = filp->private_data;
+    struct chrdevbase_dev *dev = ctx->dev;
 
-    if (retvalue == 0)
+    if (!dev->writeback)
     {
-        printk("kernel send data to user space:%s\n", writebuf);
+        return 0; /*写直达，write返回时数据已经可读*/
     }
-    else
+
+    while (!chrdevbase_wb_flush(dev))
     {
-        printk("kernel send data to user space failed\n");
+        if (filp->f_flags & O_NONBLOCK)
+        {
+            return -EAGAIN;
+        }
+        chrdevbase_stat_inc(dev, blocked_waits);
+        if (wait_event_interruptible(dev->w_wait, kfifo_is_empty(&dev->staging) || !kfifo_is_full(&dev->fifo)))
+        {
+            return -ERESTARTSYS;
+        }
     }
     return 0;
 }
 
 /*
-描述：向设备写入数据
-参数: filp: 要打开的设备文件
-      buf: 要写入的数据缓冲区
-      cnt: 要写入的数据长度
-      offt: 相对于文件首地址的偏移
-return: 写入的字节数，如果为负数，表示写入失败
+描述：close时调用，写回模式下把暂存区中的数据搬到fifo，fifo已满时不等待，剩下的数据由延迟工作继续搬运
+参数：filp：设备文件，file结构体指针
+      id：未使用
+return：0
 */
-static ssize_t chrdevbase_write(struct file *filp, const char __user *buf, size_t cnt, loff_t *offt)
+static int chrdevbase_flush(struct file *filp, fl_owner_t id)
 {
-    int retvalue = 0;
+    struct chrdevbase_ctx *ctx = filp->private_data;
 
-    /*接收用户空间传递给内核的数据并且打印出来*/
-    //将buf中的数据拷贝到writebuf中
-    retvalue = copy_from_user(writebuf, buf, cnt);
-    if (retvalue == 0)
-    {
-        printk("kernel recv data from user space:%s\n", writebuf);
-    }
-    else
+    if (ctx->dev->writeback)
     {
-        printk("kernel recv data from user space failed\n");
+        chrdevbase_wb_flush(ctx->dev);
     }
     return 0;
 }
@@ -93,20 +1941,559 @@ return：0成功；其他失败
 */
 static int chrdevbase_release(struct inode *inode, struct file *filp)
 {
-    //printk("chardevbase release\n");
+    struct chrdevbase_ctx *ctx = filp->private_data;
+
+    trace_chrdevbase_release(ctx->dev->minor, ctx->stats.read_bytes, ctx->stats.write_bytes);
+
+    /*从异步通知列表中删除*/
+    chrdevbase_fasync(-1, filp, 0);
+
+    /*上下文还给slab缓存，下次open直接复用*/
+    kmem_cache_free(chrdevbase_ctx_cache, ctx);
     return 0;
 }
 
 /*文件操作结构体*/
-static struct file_operations chardevbase_fops = 
+static struct file_operations chardevbase_fops =
 {
     .owner = THIS_MODULE,
     .open = chrdevbase_open,
-    .read = chrdevbase_read,
-    .write = chrdevbase_write,
+    .read_iter = chrdevbase_read_iter,
+    .write_iter = chrdevbase_write_iter,
+    .splice_read = chrdevbase_splice_read,
+    .splice_write = iter_file_splice_write, /*通过write_iter写入，管道中的页不经过用户空间*/
+    .poll = chrdevbase_poll,
+    .unlocked_ioctl = chrdevbase_unlocked_ioctl,
+    .mmap = chrdevbase_mmap,
+    .fasync = chrdevbase_fasync,
+    .llseek = chrdevbase_llseek,
+    .fsync = chrdevbase_fsync,
+    .flush = chrdevbase_flush,
     .release = chrdevbase_release,
 };
 
+/*
+描述：分配设备的缓冲区
+参数：dev：设备结构体
+return：0成功；其他失败
+*/
+static int chrdevbase_alloc_buffer(struct chrdevbase_dev *dev)
+{
+    if (dev->mode == CHRDEVBASE_MODE_MMAP)
+    {
+        /*数据区至少一页，并且为2的幂，方便用掩码取模*/
+        dev->ring_size = roundup_pow_of_two(max_t(unsigned int, fifo_size, PAGE_SIZE));
+
+        /*vmalloc_user分配的内存已清零，并且可以用remap_vmalloc_range映射到用户空间*/
+        dev->ring = vmalloc_user(PAGE_SIZE + dev->ring_size);
+        if (dev->ring == NULL)
+        {
+            return -ENOMEM;
+        }
+        dev->hdr = dev->ring;
+        dev->ring_data = (char *)dev->ring + PAGE_SIZE;
+        dev->hdr->size = dev->ring_size;
+        dev->hdr->data_offset = PAGE_SIZE;
+        return 0;
+    }
+
+    if (dev->mode == CHRDEVBASE_MODE_STORE)
+    {
+        /*只分配页指针数组，页本身在第一次写入时分配*/
+        dev->nr_pages = DIV_ROUND_UP(store_size, PAGE_SIZE);
+        dev->store_size = (loff_t)dev->nr_pages << PAGE_SHIFT;
+        dev->pages = vzalloc(dev->nr_pages * sizeof(*dev->pages));
+        if (dev->pages == NULL)
+        {
+            return -ENOMEM;
+        }
+        return 0;
+    }
+
+    if (dev->mode == CHRDEVBASE_MODE_PRIVATE)
+    {
+        return 0; /*缓冲区在每次open时随上下文一起分配*/
+    }
+
+    if (dev->mode == CHRDEVBASE_MODE_BROADCAST)
+    {
+        /*所有读者共享这一份消息，不按读者数复制*/
+        dev->bcast_size = roundup_pow_of_two(max_t(unsigned int, fifo_size, PAGE_SIZE));
+        dev->bcast = vmalloc(dev->bcast_size);
+        if (dev->bcast == NULL)
+        {
+            return -ENOMEM;
+        }
+        return 0;
+    }
+
+    /*管道和分帧模式：fifo从一页开始按需扩大*/
+    dev->fifo_cap = roundup_pow_of_two(max_t(unsigned int, fifo_size, 2));
+    dev->fifo_min = min_t(unsigned int, dev->fifo_cap, PAGE_SIZE);
+
+    if (dev->writeback)
+    {
+        /*暂存区和fifo一样从一页开始按需扩大*/
+        if (kfifo_alloc(&dev->staging, dev->fifo_min, GFP_KERNEL))
+        {
+            return -ENOMEM;
+        }
+        if (kfifo_alloc(&dev->fifo, dev->fifo_min, GFP_KERNEL))
+        {
+            kfifo_free(&dev->staging);
+            return -ENOMEM;
+        }
+        return 0;
+    }
+
+    return kfifo_alloc(&dev->fifo, dev->fifo_min, GFP_KERNEL);
+}
+
+/*
+描述：释放设备的缓冲区
+参数：dev：设备结构体
+return：无
+*/
+static void chrdevbase_free_buffer(struct chrdevbase_dev *dev)
+{
+    unsigned long i;
+
+    if (dev->mode == CHRDEVBASE_MODE_MMAP)
+    {
+        vfree(dev->ring);
+    }
+    else if (dev->mode == CHRDEVBASE_MODE_STORE)
+    {
+        for (i = 0; i < dev->nr_pages; i++)
+        {
+            if (dev->pages[i] != NULL)
+            {
+                __free_page(dev->pages[i]);
+            }
+        }
+        vfree(dev->pages);
+    }
+    else if (dev->mode == CHRDEVBASE_MODE_BROADCAST)
+    {
+        vfree(dev->bcast);
+    }
+    else if (dev->mode == CHRDEVBASE_MODE_PIPE || dev->mode == CHRDEVBASE_MODE_FRAMED)
+    {
+        if (dev->writeback)
+        {
+            kfifo_free(&dev->staging);
+        }
+        kfifo_free(&dev->fifo);
+    }
+}
+
+/*
+描述：把所有CPU上的统计计数相加
+参数：dev：设备结构体
+      sum：相加的结果
+return：无
+*/
+static void chrdevbase_stats_sum(struct chrdevbase_dev *dev, struct chrdevbase_pcpu_stats *sum)
+{
+    struct chrdevbase_pcpu_stats *pcpu;
+    int cpu, i;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu)
+    {
+        pcpu = per_cpu_ptr(dev->pcpu_stats, cpu);
+        sum->read_ops += pcpu->read_ops;
+        sum->read_bytes += pcpu->read_bytes;
+        sum->short_reads += pcpu->short_reads;
+        sum->write_ops += pcpu->write_ops;
+        sum->write_bytes += pcpu->write_bytes;
+        sum->blocked_waits += pcpu->blocked_waits;
+        sum->overruns += pcpu->overruns;
+        sum->read_records += pcpu->read_records;
+        sum->wb_batches += pcpu->wb_batches;
+        sum->wb_bytes += pcpu->wb_bytes;
+        sum->fifo_grows += pcpu->fifo_grows;
+        sum->fifo_shrinks += pcpu->fifo_shrinks;
+        for (i = 0; i < CHRDEVBASE_HIST_BUCKETS; i++)
+        {
+            sum->read_hist[i] += pcpu->read_hist[i];
+            sum->write_hist[i] += pcpu->write_hist[i];
+        }
+    }
+}
+
+/*
+描述：实例当前占用的缓冲区内存
+参数：dev：设备结构体
+return：字节数
+*/
+static unsigned long chrdevbase_footprint(struct chrdevbase_dev *dev)
+{
+    switch (dev->mode)
+    {
+    case CHRDEVBASE_MODE_MMAP:
+        return PAGE_SIZE + dev->ring_size;
+    case CHRDEVBASE_MODE_STORE:
+        return (READ_ONCE(dev->store_pages) << PAGE_SHIFT) + dev->nr_pages * sizeof(*dev->pages);
+    case CHRDEVBASE_MODE_PRIVATE:
+        return 0; /*缓冲区属于每个上下文*/
+    case CHRDEVBASE_MODE_BROADCAST:
+        return dev->bcast_size;
+    default:
+        return kfifo_size(&dev->fifo) + (dev->writeback ? kfifo_size(&dev->staging) : 0);
+    }
+}
+
+/*
+描述：debugfs文件stats，输出实例的计数：cat /sys/kernel/debug/chardevbase/chardevbase0/stats
+参数：m：seq_file
+      v：未使用
+return：0成功
+*/
+static int chrdevbase_stats_show(struct seq_file *m, void *v)
+{
+    struct chrdevbase_dev *dev = m->private;
+    struct chrdevbase_pcpu_stats *sum;
+
+    sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+    if (sum == NULL)
+    {
+        return -ENOMEM;
+    }
+    chrdevbase_stats_sum(dev, sum);
+
+    seq_printf(m, "read_ops %llu\n", sum->read_ops);
+    seq_printf(m, "read_bytes %llu\n", sum->read_bytes);
+    seq_printf(m, "short_reads %llu\n", sum->short_reads);
+    seq_printf(m, "write_ops %llu\n", sum->write_ops);
+    seq_printf(m, "write_bytes %llu\n", sum->write_bytes);
+    seq_printf(m, "blocked_waits %llu\n", sum->blocked_waits);
+    seq_printf(m, "overruns %llu\n", sum->overruns);
+    seq_printf(m, "read_records %llu\n", sum->read_records);
+    seq_printf(m, "wb_batches %llu\n", sum->wb_batches);
+    seq_printf(m, "wb_bytes %llu\n", sum->wb_bytes);
+    if (dev->writeback)
+    {
+        seq_printf(m, "wb_staged %u\n", kfifo_len(&dev->staging));
+    }
+    seq_printf(m, "store_pages %lu\n", READ_ONCE(dev->store_pages));
+    seq_printf(m, "fifo_grows %llu\n", sum->fifo_grows);
+    seq_printf(m, "fifo_shrinks %llu\n", sum->fifo_shrinks);
+    seq_printf(m, "buffer_bytes %lu\n", chrdevbase_footprint(dev));
+
+    kfree(sum);
+    return 0;
+}
+
+/*
+描述：输出一个延时直方图，每行为桶的下限（纳秒）和落在该桶中的操作次数，只输出非空的桶
+参数：m：seq_file
+      hist：直方图
+return：无
+*/
+static void chrdevbase_hist_show(struct seq_file *m, const u64 *hist)
+{
+    int i;
+
+    for (i = 0; i < CHRDEVBASE_HIST_BUCKETS; i++)
+    {
+        if (hist[i] != 0)
+        {
+            seq_printf(m, "%llu %llu\n", i == 0 ? 0ULL : 1ULL << (i - 1), hist[i]);
+        }
+    }
+}
+
+/*
+描述：debugfs文件read_latency和write_latency，输出read/write耗时的直方图
+参数：m：seq_file，private为设备结构体
+      write：true输出write的直方图，false输出read的直方图
+return：0成功
+*/
+static int chrdevbase_latency_show(struct seq_file *m, bool write)
+{
+    struct chrdevbase_pcpu_stats *sum;
+
+    sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+    if (sum == NULL)
+    {
+        return -ENOMEM;
+    }
+    chrdevbase_stats_sum(m->private, sum);
+    chrdevbase_hist_show(m, write ? sum->write_hist : sum->read_hist);
+    kfree(sum);
+    return 0;
+}
+
+static int chrdevbase_read_latency_show(struct seq_file *m, void *v)
+{
+    return chrdevbase_latency_show(m, false);
+}
+
+static int chrdevbase_write_latency_show(struct seq_file *m, void *v)
+{
+    return chrdevbase_latency_show(m, true);
+}
+
+static int chrdevbase_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, chrdevbase_stats_show, inode->i_private);
+}
+
+static int chrdevbase_read_latency_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, chrdevbase_read_latency_show, inode->i_private);
+}
+
+static int chrdevbase_write_latency_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, chrdevbase_write_latency_show, inode->i_private);
+}
+
+static const struct file_operations chrdevbase_stats_fops = {
+    .owner = THIS_MODULE,
+    .open = chrdevbase_stats_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations chrdevbase_read_latency_fops = {
+    .owner = THIS_MODULE,
+    .open = chrdevbase_read_latency_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations chrdevbase_write_latency_fops = {
+    .owner = THIS_MODULE,
+    .open = chrdevbase_write_latency_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/*
+描述：在debugfs中创建实例的统计文件，debugfs不可用时静默跳过
+参数：dev：设备结构体
+      name：目录名，与设备节点同名
+return：无
+*/
+static void chrdevbase_debugfs_init(struct chrdevbase_dev *dev, const char *name)
+{
+    if (IS_ERR_OR_NULL(chrdevbase.debugfs))
+    {
+        return;
+    }
+
+    dev->debugfs = debugfs_create_dir(name, chrdevbase.debugfs);
+    if (IS_ERR_OR_NULL(dev->debugfs))
+    {
+        return;
+    }
+
+    debugfs_create_file("stats", 0444, dev->debugfs, dev, &chrdevbase_stats_fops);
+    debugfs_create_file("read_latency", 0444, dev->debugfs, dev, &chrdevbase_read_latency_fops);
+    debugfs_create_file("write_latency", 0444, dev->debugfs, dev, &chrdevbase_write_latency_fops);
+}
+
+/*
+描述：创建一个实例：分配缓冲区，添加cdev并创建设备节点
+参数：minor：次设备号
+      node：实例内存所在的NUMA节点，NUMA_NO_NODE表示不指定
+      name：设备节点名字
+return：0成功；其他失败
+*/
+static int chrdevbase_create_dev(int minor, int node, const char *name)
+{
+    int retvalue = 0;
+    struct chrdevbase_dev *dev;
+    dev_t devid = MKDEV(chrdevbase.major, minor);
+
+    dev = kzalloc_node(sizeof(*dev), GFP_KERNEL, node);
+    if (dev == NULL)
+    {
+        return -ENOMEM;
+    }
+    dev->minor = minor;
+    dev->mode = mode;
+    dev->writeback = writeback && mode == CHRDEVBASE_MODE_PIPE;
+    INIT_DELAYED_WORK(&dev->wb_work, chrdevbase_wb_work);
+
+    dev->pcpu_stats = alloc_percpu(struct chrdevbase_pcpu_stats);
+    if (dev->pcpu_stats == NULL)
+    {
+        retvalue = -ENOMEM;
+        goto free_dev;
+    }
+
+    /*初始化缓冲区、互斥锁和等待队列*/
+    retvalue = chrdevbase_alloc_buffer(dev);
+    if (retvalue < 0)
+    {
+        goto free_stats;
+    }
+    mutex_init(&dev->lock);
+    init_waitqueue_head(&dev->r_wait);
+    init_waitqueue_head(&dev->w_wait);
+
+    /*初始化并添加cdev*/
+    dev->cdev.owner = THIS_MODULE;
+    cdev_init(&dev->cdev, &chardevbase_fops);
+    retvalue = cdev_add(&dev->cdev, devid, 1);
+    if (retvalue < 0)
+    {
+        goto free_buffer;
+    }
+
+    /*创建设备，drvdata指向实例*/
+    dev->device = device_create(chrdevbase.class, NULL, devid, dev, "%s", name);
+    if (IS_ERR(dev->device))
+    {
+        retvalue = PTR_ERR(dev->device);
+        goto del_cdev;
+    }
+
+    chrdevbase_debugfs_init(dev, name);
+    chrdevbase.devs[minor] = dev;
+    return 0;
+
+del_cdev:
+    cdev_del(&dev->cdev);
+free_buffer:
+    chrdevbase_free_buffer(dev);
+free_stats:
+    free_percpu(dev->pcpu_stats);
+free_dev:
+    kfree(dev);
+    return retvalue;
+}
+
+/*
+描述：销毁一个实例
+参数：dev：设备结构体
+return：无
+*/
+static void chrdevbase_destroy_dev(struct chrdevbase_dev *dev)
+{
+    debugfs_remove_recursive(dev->debugfs);
+    device_destroy(chrdevbase.class, MKDEV(chrdevbase.major, dev->minor));
+    cdev_del(&dev->cdev);
+    cancel_delayed_work_sync(&dev->wb_work); /*暂存区中没有被读走的数据随缓冲区一起释放*/
+    chrdevbase_free_buffer(dev);
+    free_percpu(dev->pcpu_stats);
+    kfree(dev);
+}
+
+/*
+描述：销毁所有已经创建的实例，并释放设备号
+参数：无
+return：无
+*/
+static void chrdevbase_cleanup(void)
+{
+    unsigned int i;
+
+    for (i = 0; chrdevbase.devs != NULL && i < chrdevbase.nr_devs; i++)
+    {
+        if (chrdevbase.devs[i] != NULL)
+        {
+            chrdevbase_destroy_dev(chrdevbase.devs[i]);
+        }
+    }
+    debugfs_remove_recursive(chrdevbase.debugfs);
+    class_destroy(chrdevbase.class);
+    kfree(chrdevbase.devs);
+    unregister_chrdev_region(chrdevbase.devid, chrdevbase.nr_devs);
+    kmem_cache_destroy(chrdevbase_ctx_cache);
+}
+
+/*
+描述：shrinker统计可以释放的页数：管道和分帧模式下fifo和写回暂存区超出已有数据所需的部分
+参数：shrink：shrinker
+      sc：回收控制
+return：可以释放的页数
+*/
+static unsigned long chrdevbase_shrink_count(struct shrinker *shrink, struct shrink_control *sc)
+{
+    struct chrdevbase_dev *dev;
+    unsigned long count = 0;
+    unsigned int i;
+
+    for (i = 0; i < chrdevbase.nr_devs; i++)
+    {
+        dev = chrdevbase.devs[i];
+        if (dev == NULL || dev->fifo_cap == 0)
+        {
+            continue;
+        }
+        /*不加锁估算，真正缩小时持锁重新计算*/
+        count += chrdevbase_fifo_excess(dev, &dev->fifo) >> PAGE_SHIFT;
+        if (dev->writeback)
+        {
+            count += chrdevbase_fifo_excess(dev, &dev->staging) >> PAGE_SHIFT;
+        }
+    }
+    return count;
+}
+
+/*
+描述：把fifo缩小到目标大小，调用者持有dev->lock
+参数：dev：设备结构体
+      fifo：dev->fifo或dev->staging
+return：释放的页数
+*/
+static unsigned long chrdevbase_fifo_shrink(struct chrdevbase_dev *dev, struct kfifo *fifo)
+{
+    unsigned int size = kfifo_size(fifo);
+    unsigned int target = chrdevbase_fifo_target(dev, fifo);
+
+    if (target >= size || !chrdevbase_fifo_resize(fifo, target, GFP_NOWAIT | __GFP_NOWARN))
+    {
+        return 0;
+    }
+    chrdevbase_stat_inc(dev, fifo_shrinks);
+    return (size - target) >> PAGE_SHIFT;
+}
+
+/*
+描述：内存紧张时缩小空闲或已经读空的fifo和写回暂存区，正在使用的实例（拿不到锁）直接跳过
+      新缓冲区比旧的小，用GFP_NOWAIT分配，不会在回收过程中再进入回收
+参数：shrink：shrinker
+      sc：回收控制，nr_to_scan为希望释放的页数
+return：释放的页数，没有可释放的返回SHRINK_STOP
+*/
+static unsigned long chrdevbase_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
+{
+    struct chrdevbase_dev *dev;
+    unsigned long freed = 0;
+    unsigned int i;
+
+    for (i = 0; i < chrdevbase.nr_devs && freed < sc->nr_to_scan; i++)
+    {
+        dev = chrdevbase.devs[i];
+        if (dev == NULL || dev->fifo_cap == 0 || !mutex_trylock(&dev->lock))
+        {
+            continue;
+        }
+
+        freed += chrdevbase_fifo_shrink(dev, &dev->fifo);
+        if (dev->writeback)
+        {
+            freed += chrdevbase_fifo_shrink(dev, &dev->staging);
+        }
+        mutex_unlock(&dev->lock);
+    }
+    return freed != 0 ? freed : SHRINK_STOP;
+}
+
+static struct shrinker chrdevbase_shrinker = {
+    .count_objects = chrdevbase_shrink_count,
+    .scan_objects = chrdevbase_shrink_scan,
+    .seeks = DEFAULT_SEEKS,
+};
+
 /*
 描述：驱动入口函数
 参数：无
@@ -115,16 +2502,106 @@ return：0成功；其他失败
 static int __init chrdevbase_init(void)
 {
     int retvalue = 0;
+    unsigned int i;
+    int cpu;
+    char name[32];
+
+    if (mode < CHRDEVBASE_MODE_PIPE || mode > CHRDEVBASE_MODE_FRAMED)
+    {
+        printk("chardevbase invalid mode %d\n", mode);
+        return -EINVAL;
+    }
+
+    /*普通实例在前，每CPU实例在后，第cpu个CPU的实例次设备号为minors + cpu*/
+    chrdevbase.nr_devs = minors + (percpu ? nr_cpu_ids : 0);
+    if (chrdevbase.nr_devs == 0)
+    {
+        printk("chardevbase no instance to create\n");
+        return -EINVAL;
+    }
 
-    /*注册字符设备驱动*/
-    retvalue = register_chrdev(CHRDEVBASE_MAJOR, CHRDEVBASE_NAME, &chardevbase_fops);
+    /*1、创建上下文的slab缓存，私有模式下缓冲区紧跟在上下文后面*/
+    if (mode == CHRDEVBASE_MODE_PRIVATE)
+    {
+        chrdevbase_ctx_buf_size = roundup_pow_of_two(max_t(unsigned int, fifo_size, 2));
+    }
+    chrdevbase_ctx_cache = kmem_cache_create("chrdevbase_ctx", sizeof(struct chrdevbase_ctx) + chrdevbase_ctx_buf_size,
+                                             0, SLAB_HWCACHE_ALIGN, NULL);
+    if (chrdevbase_ctx_cache == NULL)
+    {
+        return -ENOMEM;
+    }
 
+    /*2、申请设备号*/
+    retvalue = alloc_chrdev_region(&chrdevbase.devid, 0, chrdevbase.nr_devs, CHRDEVBASE_NAME);
     if (retvalue < 0)
     {
         printk("chardevbase register failed\n");
+        kmem_cache_destroy(chrdevbase_ctx_cache);
+        return retvalue;
+    }
+    chrdevbase.major = MAJOR(chrdevbase.devid);
+
+    /*3、创建类*/
+    chrdevbase.class = class_create(THIS_MODULE, CHRDEVBASE_NAME);
+    if (IS_ERR(chrdevbase.class))
+    {
+        unregister_chrdev_region(chrdevbase.devid, chrdevbase.nr_devs);
+        kmem_cache_destroy(chrdevbase_ctx_cache);
+        return PTR_ERR(chrdevbase.class);
     }
-    printk("chardevbase register success\n");
+
+    /*统计信息的debugfs根目录，创建失败不影响设备使用*/
+    chrdevbase.debugfs = debugfs_create_dir(CHRDEVBASE_NAME, NULL);
+
+    chrdevbase.devs = kcalloc(chrdevbase.nr_devs, sizeof(*chrdevbase.devs), GFP_KERNEL);
+    if (chrdevbase.devs == NULL)
+    {
+        retvalue = -ENOMEM;
+        goto cleanup;
+    }
+
+    /*4、创建普通实例*/
+    for (i = 0; i < minors; i++)
+    {
+        snprintf(name, sizeof(name), "%s%u", CHRDEVBASE_NAME, i);
+        retvalue = chrdevbase_create_dev(i, NUMA_NO_NODE, name);
+        if (retvalue < 0)
+        {
+            goto cleanup;
+        }
+    }
+
+    /*5、创建每CPU实例，固定在某个CPU上的生产者只访问自己的实例*/
+    if (percpu)
+    {
+        for_each_possible_cpu(cpu)
+        {
+            snprintf(name, sizeof(name), "%s_cpu%d", CHRDEVBASE_NAME, cpu);
+            retvalue = chrdevbase_create_dev(minors + cpu, cpu_to_node(cpu), name);
+            if (retvalue < 0)
+            {
+                goto cleanup;
+            }
+        }
+    }
+
+    /*6、所有实例创建完成以后注册shrinker，它会遍历实例数组*/
+    retvalue = register_shrinker(&chrdevbase_shrinker);
+    if (retvalue < 0)
+    {
+        goto cleanup;
+    }
+
+    printk("chardevbase register success, major = %d, instances = %u, mode = %d%s\n",
+           chrdevbase.major, chrdevbase.nr_devs, mode,
+           (writeback && mode == CHRDEVBASE_MODE_PIPE) ? ", write-back" : "");
     return 0;
+
+cleanup:
+    printk("chardevbase create instance failed\n");
+    chrdevbase_cleanup();
+    return retvalue;
 }
 
 /*
@@ -134,8 +2611,9 @@ return：无
 */
 static void __exit chrdevbase_exit(void)
 {
-    /*注销字符设备驱动*/
-    unregister_chrdev(CHRDEVBASE_MAJOR, CHRDEVBASE_NAME);
+    /*销毁所有实例并注销设备号*/
+    unregister_shrinker(&chrdevbase_shrinker);
+    chrdevbase_cleanup();
     printk("chardevbase_exit()\n");
     printk("chardevbase unregister success\n");
 }
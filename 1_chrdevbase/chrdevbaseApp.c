@@ -1,3 +1,4 @@
+#define _GNU_SOURCE /*splice、vmsplice*/
 #include "stdio.h"
 #include "unistd.h"
 #include "sys/types.h"
@@ -5,10 +6,612 @@
 #include "fcntl.h"
 #include "stdlib.h"
 #include "string.h"
+#include "sys/ioctl.h"
+#include "sys/mman.h"
+#include "linux/ioctl.h"
+#include "linux/types.h"
+#include "pthread.h"
+#include "time.h"
+#include "sys/uio.h"
+
+/*命令值，与驱动中的定义保持一致*/
+#define CHRDEVBASE_IOC_MAGIC      0xEC
+#define CHRDEVBASE_IOC_WAIT_DATA  (_IO(CHRDEVBASE_IOC_MAGIC, 0x1)) /*等待环形缓冲区中有数据*/
+#define CHRDEVBASE_IOC_WAIT_SPACE (_IO(CHRDEVBASE_IOC_MAGIC, 0x2)) /*等待环形缓冲区中有空间*/
+#define CHRDEVBASE_IOC_WAKE       (_IO(CHRDEVBASE_IOC_MAGIC, 0x3)) /*更新head/tail后唤醒对方*/
+
+#define CHRDEVBASE_CACHELINE 64
+
+/*mmap共享环形缓冲区的头部，与驱动中的定义保持一致*/
+struct chrdevbase_ring_hdr
+{
+    __u32 size;        /*数据区大小，2的幂*/
+    __u32 data_offset; /*数据区相对于映射起始地址的偏移*/
+    __u8 pad0[CHRDEVBASE_CACHELINE - 2 * sizeof(__u32)];
+    __u32 head;             /*生产者位置*/
+    __u32 consumer_waiting; /*消费者正在等待数据*/
+    __u8 pad1[CHRDEVBASE_CACHELINE - 2 * sizeof(__u32)];
+    __u32 tail;             /*消费者位置*/
+    __u32 producer_waiting; /*生产者正在等待空间*/
+    __u8 pad2[CHRDEVBASE_CACHELINE - 2 * sizeof(__u32)];
+};
 
 /*测试app要向chrdevbase设备写入的数据*/
 static char usrdata[] = {"usr data"};
 
+/*
+描述：映射设备的共享环形缓冲区
+参数：fd：设备文件描述符
+return：环形缓冲区头部，NULL表示失败
+*/
+static struct chrdevbase_ring_hdr *ring_map(int fd)
+{
+    struct chrdevbase_ring_hdr *hdr;
+    size_t len;
+
+    /*先只映射头部页，得到数据区的大小以后再映射整个区域*/
+    hdr = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED)
+    {
+        return NULL;
+    }
+    len = hdr->data_offset + hdr->size;
+    munmap(hdr, sysconf(_SC_PAGESIZE));
+
+    hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return hdr == MAP_FAILED ? NULL : hdr;
+}
+
+/*
+描述：从共享环形缓冲区中读取数据，没有数据时才进入内核休眠
+参数：fd：设备文件描述符
+      hdr：环形缓冲区头部
+      buf：数据缓冲区
+      cnt：最多读取的字节数
+return：读取的字节数，负数表示失败
+*/
+static int ring_read(int fd, struct chrdevbase_ring_hdr *hdr, char *buf, unsigned int cnt)
+{
+    char *data = (char *)hdr + hdr->data_offset;
+    unsigned int head, tail, len, off, first;
+
+    tail = hdr->tail;
+    while ((head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE)) == tail)
+    {
+        if (ioctl(fd, CHRDEVBASE_IOC_WAIT_DATA) < 0)
+        {
+            return -1;
+        }
+    }
+
+    len = head - tail < cnt ? head - tail : cnt;
+    off = tail & (hdr->size - 1);
+    first = len < hdr->size - off ? len : hdr->size - off;
+    memcpy(buf, data + off, first);
+    memcpy(buf + first, data, len - first);
+    __atomic_store_n(&hdr->tail, tail + len, __ATOMIC_RELEASE);
+
+    /*生产者在内核中等待空间时才需要唤醒它*/
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (hdr->producer_waiting)
+    {
+        ioctl(fd, CHRDEVBASE_IOC_WAKE);
+    }
+    return len;
+}
+
+/*
+描述：向共享环形缓冲区写入数据，没有空间时才进入内核休眠
+参数：fd：设备文件描述符
+      hdr：环形缓冲区头部
+      buf：数据缓冲区
+      cnt：最多写入的字节数
+return：写入的字节数，负数表示失败
+*/
+static int ring_write(int fd, struct chrdevbase_ring_hdr *hdr, const char *buf, unsigned int cnt)
+{
+    char *data = (char *)hdr + hdr->data_offset;
+    unsigned int head, tail, len, off, first;
+
+    head = hdr->head;
+    while (head - (tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE)) == hdr->size)
+    {
+        if (ioctl(fd, CHRDEVBASE_IOC_WAIT_SPACE) < 0)
+        {
+            return -1;
+        }
+    }
+
+    len = hdr->size - (head - tail) < cnt ? hdr->size - (head - tail) : cnt;
+    off = head & (hdr->size - 1);
+    first = len < hdr->size - off ? len : hdr->size - off;
+    memcpy(data + off, buf, first);
+    memcpy(data, buf + first, len - first);
+    __atomic_store_n(&hdr->head, head + len, __ATOMIC_RELEASE);
+
+    /*消费者在内核中等待数据时才需要唤醒它*/
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (hdr->consumer_waiting)
+    {
+        ioctl(fd, CHRDEVBASE_IOC_WAKE);
+    }
+    return len;
+}
+
+/*
+基准测试模式：
+./chrdevbaseApp <设备> bench [-m copy|mmap|store|splice] [-s 大小列表] [-n 次数列表] [-t 线程数]
+-m：传输方式，copy为write+read（默认），mmap为共享环形缓冲区（驱动mode=1），store为pwrite+pread（驱动mode=2），
+    splice为vmsplice到管道后splice进设备，再从设备splice到管道、由管道splice到/dev/null（驱动mode=0）
+-s：逗号分隔的消息大小，默认16,64,256,1024,4096,16384,65536
+-n：逗号分隔的每个线程每种大小的操作次数，默认10000
+-t：线程数，默认1；设备名中含有%d时，第i个线程打开用i格式化后的设备，例如/dev/chardevbase_cpu%d
+    mmap的环形缓冲区只支持一个生产者和一个消费者，多线程的mmap测试必须用%d让每个线程打开自己的实例
+每种次数和大小的组合输出一行CSV：transport,size,threads,iters,mb_s,ops_s,p50_ns,p99_ns,p999_ns
+一次操作是一个完整的往返：写入size字节，再读回size字节；吞吐量按写入的字节数计算
+编译：arm-linux-gnueabihf-gcc chrdevbaseApp.c -o chrdevbaseApp -lpthread
+*/
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_SIZES   32
+#define BENCH_MAX_ITERS   16
+
+/*驱动参数fifo_size，splice测试每次最多传输fifo_size和一页中较小的那个*/
+#define BENCH_FIFO_SIZE_PARAM "/sys/module/chrdevbase/parameters/fifo_size"
+
+/*传输方式*/
+enum bench_transport
+{
+    BENCH_COPY,
+    BENCH_MMAP,
+    BENCH_STORE,
+    BENCH_SPLICE,
+};
+
+static const char *bench_transport_name[] = {"copy", "mmap", "store", "splice"};
+
+/*每个线程的参数和结果*/
+struct bench_thread
+{
+    pthread_t tid;
+    char filename[256];             /*设备文件名*/
+    enum bench_transport transport; /*传输方式*/
+    size_t size;                    /*消息大小*/
+    long iters;                     /*操作次数*/
+    unsigned long long *lat;        /*每次操作的耗时，单位纳秒*/
+    int error;                      /*非0表示出错*/
+};
+
+/*所有线程打开设备以后同时开始*/
+static pthread_barrier_t bench_barrier;
+
+/*
+描述：获取单调时钟，单位纳秒
+参数：无
+return：当前时间
+*/
+static unsigned long long bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+描述：通过write/read完成一次往返，写进去多少就读回多少，消息比驱动缓冲区大时也不会卡住
+参数：fd：设备文件描述符
+      buf：数据缓冲区
+      len：消息大小
+return：0成功；-1失败
+*/
+static int bench_copy_once(int fd, char *buf, size_t len)
+{
+    size_t done = 0, got;
+    ssize_t w, r;
+
+    while (done < len)
+    {
+        w = write(fd, buf + done, len - done);
+        if (w <= 0)
+        {
+            return -1;
+        }
+        for (got = 0; got < (size_t)w; got += r)
+        {
+            r = read(fd, buf + done + got, w - got);
+            if (r <= 0)
+            {
+                return -1;
+            }
+        }
+        done += w;
+    }
+    return 0;
+}
+
+/*
+描述：通过mmap共享环形缓冲区完成一次往返
+参数：fd：设备文件描述符
+      hdr：环形缓冲区头部
+      buf：数据缓冲区
+      len：消息大小
+return：0成功；-1失败
+*/
+static int bench_mmap_once(int fd, struct chrdevbase_ring_hdr *hdr, char *buf, size_t len)
+{
+    size_t done = 0, got;
+    int w, r;
+
+    while (done < len)
+    {
+        w = ring_write(fd, hdr, buf + done, len - done);
+        if (w <= 0)
+        {
+            return -1;
+        }
+        for (got = 0; got < (size_t)w; got += r)
+        {
+            r = ring_read(fd, hdr, buf + done + got, w - got);
+            if (r <= 0)
+            {
+                return -1;
+            }
+        }
+        done += w;
+    }
+    return 0;
+}
+
+/*
+描述：通过pwrite/pread在存储区的off处完成一次往返
+参数：fd：设备文件描述符
+      buf：数据缓冲区
+      len：消息大小
+      off：存储区中的位置
+return：0成功；-1失败
+*/
+static int bench_store_once(int fd, char *buf, size_t len, off_t off)
+{
+    if (pwrite(fd, buf, len, off) != (ssize_t)len)
+    {
+        return -1;
+    }
+    if (pread(fd, buf, len, off) != (ssize_t)len)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+描述：splice测试每次传输的最大字节数
+      驱动的fifo从min(fifo_size, 一页)开始，iter_file_splice_write写不完时会接着写并休眠，
+      每次只传输fifo一定放得下的数据，读回以后fifo又是空的，单线程往返就不会卡住
+参数：无
+return：字节数
+*/
+static size_t bench_splice_chunk(void)
+{
+    size_t chunk = sysconf(_SC_PAGESIZE);
+    unsigned long fifo_size;
+    FILE *fp;
+
+    fp = fopen(BENCH_FIFO_SIZE_PARAM, "r");
+    if (fp != NULL)
+    {
+        if (fscanf(fp, "%lu", &fifo_size) == 1 && fifo_size > 0 && fifo_size < chunk)
+        {
+            chunk = fifo_size;
+        }
+        fclose(fp);
+    }
+    return chunk;
+}
+
+/*
+描述：通过splice完成一次往返，数据不经过read/write的用户缓冲区拷贝
+      buf用vmsplice挂到输入管道，splice进设备；再从设备splice到输出管道，最后splice到sink丢弃
+参数：fd：设备文件描述符
+      in：输入管道
+      out：输出管道
+      sink：丢弃数据的文件描述符，/dev/null
+      buf：数据缓冲区
+      len：消息大小
+      chunk：每次最多传输的字节数
+return：0成功；-1失败
+*/
+static int bench_splice_once(int fd, const int *in, const int *out, int sink, char *buf, size_t len, size_t chunk)
+{
+    struct iovec iov;
+    size_t done = 0, queued = 0, got;
+    ssize_t n, w, r;
+
+    while (done < len)
+    {
+        /*上一块已经全部写进设备，把下一块挂到输入管道*/
+        if (queued == 0)
+        {
+            iov.iov_base = buf + done;
+            iov.iov_len = (len - done < chunk) ? len - done : chunk;
+            n = vmsplice(in[1], &iov, 1, 0);
+            if (n <= 0)
+            {
+                return -1;
+            }
+            queued = n;
+        }
+
+        w = splice(in[0], NULL, fd, NULL, queued, SPLICE_F_MOVE);
+        if (w <= 0)
+        {
+            return -1;
+        }
+        queued -= w;
+
+        /*写进去多少就读回多少*/
+        for (got = 0; got < (size_t)w; got += r)
+        {
+            r = splice(fd, NULL, out[1], NULL, w - got, SPLICE_F_MOVE);
+            if (r <= 0 || splice(out[0], NULL, sink, NULL, r, SPLICE_F_MOVE) != r)
+            {
+                return -1;
+            }
+        }
+        done += w;
+    }
+    return 0;
+}
+
+/*
+描述：测试线程，打开设备后等待其他线程，然后连续执行iters次操作并记录每次的耗时
+参数：arg：struct bench_thread
+return：NULL
+*/
+static void *bench_thread_fn(void *arg)
+{
+    struct bench_thread *t = arg;
+    struct chrdevbase_ring_hdr *hdr = NULL;
+    char *buf;
+    off_t cap = 0, off = 0;
+    unsigned long long start;
+    size_t chunk = 0;
+    int in[2] = {-1, -1}, out[2] = {-1, -1}, sink = -1;
+    long i;
+    int fd;
+
+    buf = malloc(t->size);
+    fd = open(t->filename, O_RDWR);
+    if (buf == NULL || fd < 0)
+    {
+        t->error = 1;
+    }
+    else
+    {
+        memset(buf, 0x5A, t->size);
+        if (t->transport == BENCH_MMAP)
+        {
+            hdr = ring_map(fd);
+            t->error = (hdr == NULL);
+        }
+        else if (t->transport == BENCH_STORE)
+        {
+            cap = lseek(fd, 0, SEEK_END);
+            t->error = (cap < (off_t)t->size);
+        }
+        else if (t->transport == BENCH_SPLICE)
+        {
+            chunk = bench_splice_chunk();
+            sink = open("/dev/null", O_WRONLY);
+            t->error = (pipe(in) < 0 || pipe(out) < 0 || sink < 0);
+        }
+    }
+
+    /*出错的线程也要到达屏障，否则其他线程会一直等待*/
+    pthread_barrier_wait(&bench_barrier);
+
+    for (i = 0; i < t->iters && !t->error; i++)
+    {
+        start = bench_now_ns();
+        switch (t->transport)
+        {
+        case BENCH_COPY:
+            t->error = bench_copy_once(fd, buf, t->size);
+            break;
+        case BENCH_MMAP:
+            t->error = bench_mmap_once(fd, hdr, buf, t->size);
+            break;
+        case BENCH_STORE:
+            t->error = bench_store_once(fd, buf, t->size, off);
+            off = (off + (off_t)(2 * t->size) > cap) ? 0 : off + (off_t)t->size; /*依次访问整个存储区*/
+            break;
+        case BENCH_SPLICE:
+            t->error = bench_splice_once(fd, in, out, sink, buf, t->size, chunk);
+            break;
+        }
+        t->lat[i] = bench_now_ns() - start;
+    }
+
+    if (hdr != NULL)
+    {
+        munmap(hdr, hdr->data_offset + hdr->size);
+    }
+    for (i = 0; i < 2; i++)
+    {
+        if (in[i] >= 0)
+        {
+            close(in[i]);
+        }
+        if (out[i] >= 0)
+        {
+            close(out[i]);
+        }
+    }
+    if (sink >= 0)
+    {
+        close(sink);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    free(buf);
+    return NULL;
+}
+
+/*qsort比较函数*/
+static int bench_cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+描述：基准测试入口，对每种消息大小运行一轮并输出一行CSV
+参数：argc、argv：main的参数，argv[2]为"bench"
+return：0成功；其他失败
+*/
+static int bench_main(int argc, char *argv[])
+{
+    enum bench_transport transport = BENCH_COPY;
+    char sizelist[256] = "16,64,256,1024,4096,16384,65536";
+    char iterlist[256] = "10000";
+    size_t sizes[BENCH_MAX_SIZES];
+    long iter_counts[BENCH_MAX_ITERS], iters, maxiters = 0;
+    int nsizes = 0, niters = 0, nthreads = 1, opt, i, j, k;
+    struct bench_thread *threads;
+    unsigned long long *all, start, elapsed;
+    char *tok;
+
+    /*从"bench"开始解析选项*/
+    while ((opt = getopt(argc - 2, argv + 2, "m:s:n:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            for (i = 0; i <= BENCH_SPLICE && strcmp(optarg, bench_transport_name[i]) != 0; i++)
+            {
+            }
+            if (i > BENCH_SPLICE)
+            {
+                printf("unknown transport %s\n", optarg);
+                return -1;
+            }
+            transport = i;
+            break;
+        case 's':
+            snprintf(sizelist, sizeof(sizelist), "%s", optarg);
+            break;
+        case 'n':
+            snprintf(iterlist, sizeof(iterlist), "%s", optarg);
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        default:
+            printf("Usage:%s <dev> bench [-m copy|mmap|store|splice] [-s sizes] [-n iters] [-t threads]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (nthreads <= 0 || nthreads > BENCH_MAX_THREADS)
+    {
+        printf("invalid threads\n");
+        return -1;
+    }
+    /*多个线程同时读写同一个实例的环形缓冲区会破坏读写位置*/
+    if (transport == BENCH_MMAP && nthreads > 1 && strstr(argv[1], "%d") == NULL)
+    {
+        printf("mmap with more than one thread needs a device name with %%d\n");
+        return -1;
+    }
+    for (tok = strtok(iterlist, ","); tok != NULL && niters < BENCH_MAX_ITERS; tok = strtok(NULL, ","))
+    {
+        iter_counts[niters] = atol(tok);
+        if (iter_counts[niters] > 0)
+        {
+            maxiters = iter_counts[niters] > maxiters ? iter_counts[niters] : maxiters;
+            niters++;
+        }
+    }
+    if (niters == 0)
+    {
+        printf("invalid iters\n");
+        return -1;
+    }
+    for (tok = strtok(sizelist, ","); tok != NULL && nsizes < BENCH_MAX_SIZES; tok = strtok(NULL, ","))
+    {
+        sizes[nsizes] = strtoul(tok, NULL, 0);
+        if (sizes[nsizes] > 0)
+        {
+            nsizes++;
+        }
+    }
+
+    threads = calloc(nthreads, sizeof(*threads));
+    all = malloc(sizeof(*all) * maxiters * nthreads);
+    if (threads == NULL || all == NULL)
+    {
+        printf("out of memory\n");
+        return -1;
+    }
+
+    printf("transport,size,threads,iters,mb_s,ops_s,p50_ns,p99_ns,p999_ns\n");
+    for (k = 0; k < niters * nsizes; k++)
+    {
+        unsigned long long ops;
+        int error = 0;
+
+        /*外层按次数，内层按大小*/
+        iters = iter_counts[k / nsizes];
+        j = k % nsizes;
+        ops = (unsigned long long)iters * nthreads;
+
+        pthread_barrier_init(&bench_barrier, NULL, nthreads + 1);
+        for (i = 0; i < nthreads; i++)
+        {
+            snprintf(threads[i].filename, sizeof(threads[i].filename), argv[1], i);
+            threads[i].transport = transport;
+            threads[i].size = sizes[j];
+            threads[i].iters = iters;
+            threads[i].lat = all + (size_t)i * iters; /*各线程的耗时连续存放，方便一起排序*/
+            threads[i].error = 0;
+            pthread_create(&threads[i].tid, NULL, bench_thread_fn, &threads[i]);
+        }
+
+        /*所有线程准备好以后开始计时，全部结束以后停止计时*/
+        pthread_barrier_wait(&bench_barrier);
+        start = bench_now_ns();
+        for (i = 0; i < nthreads; i++)
+        {
+            pthread_join(threads[i].tid, NULL);
+            error |= threads[i].error;
+        }
+        elapsed = bench_now_ns() - start;
+        pthread_barrier_destroy(&bench_barrier);
+
+        if (error)
+        {
+            printf("# %s size %zu iters %ld failed\n", bench_transport_name[transport], sizes[j], iters);
+            continue;
+        }
+
+        /*所有线程的耗时合在一起排序后取百分位*/
+        qsort(all, ops, sizeof(*all), bench_cmp_ull);
+        printf("%s,%zu,%d,%ld,%.2f,%.0f,%llu,%llu,%llu\n",
+               bench_transport_name[transport], sizes[j], nthreads, iters,
+               (double)ops * sizes[j] * 1000.0 / elapsed,
+               (double)ops * 1000000000.0 / elapsed,
+               all[(ops - 1) * 50 / 100], all[(ops - 1) * 99 / 100], all[(ops - 1) * 999 / 1000]);
+        fflush(stdout);
+    }
+
+    free(all);
+    free(threads);
+    return 0;
+}
+
 /*
 argc:命令行参数的个数
 argv:命令行参数的内容
@@ -21,9 +624,13 @@ argv[3]="arg3"
 */
 
 /*
-./chrdevbaseApp /dev/chrdevbase 1
+./chrdevbaseApp /dev/chardevbase0 1
 1表示从设备读取数据
 2表示写入数据到设备
+3表示通过mmap共享环形缓冲区读取数据（驱动以mode=1加载）
+4表示通过mmap共享环形缓冲区写入数据（驱动以mode=1加载）
+5表示读取一批记录并逐条打印（驱动以mode=5加载）
+bench表示运行基准测试，见bench_main前的说明
 */
 int main(int argc, char *argv[])
 {
@@ -31,6 +638,15 @@ int main(int argc, char *argv[])
 
     char *filename;
     char readbuf[100], writebuf[100];
+    char batchbuf[4096];
+    struct chrdevbase_ring_hdr *hdr;
+    __u32 reclen;
+    int off;
+
+    if (argc >= 3 && strcmp(argv[2], "bench") == 0)
+    {
+        return bench_main(argc, argv);
+    }
 
     if(argc != 3) //参数不为三，说明输入有误
     {
@@ -65,7 +681,8 @@ int main(int argc, char *argv[])
         }
         else
         {
-            printf("read data:%s\n", readbuf);
+            /*设备是数据流，返回的数据不一定以'\0'结尾*/
+            printf("read data:%.*s\n", retvalue, readbuf);
         }
     }
 
@@ -73,7 +690,7 @@ int main(int argc, char *argv[])
     {
         /*向设备写入数据*/
         memcpy(writebuf, usrdata, sizeof(usrdata));
-        retvalue = write(fd, writebuf, 50);
+        retvalue = write(fd, writebuf, sizeof(usrdata));
         if (retvalue < 0)
         {
             printf("write file %s failed\n", filename);
@@ -84,6 +701,58 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (atoi(argv[2]) == 3 || atoi(argv[2]) == 4)
+    {
+        hdr = ring_map(fd);
+        if (hdr == NULL)
+        {
+            printf("mmap file %s failed\n", filename);
+            close(fd);
+            return -1;
+        }
+
+        if (atoi(argv[2]) == 3) /*不经过read系统调用，直接从共享内存读取*/
+        {
+            retvalue = ring_read(fd, hdr, readbuf, 50);
+            if (retvalue < 0)
+            {
+                printf("ring read %s failed\n", filename);
+            }
+            else
+            {
+                printf("ring read data:%.*s\n", retvalue, readbuf);
+            }
+        }
+        else /*不经过write系统调用，直接写入共享内存*/
+        {
+            retvalue = ring_write(fd, hdr, usrdata, sizeof(usrdata));
+            if (retvalue < 0)
+            {
+                printf("ring write %s failed\n", filename);
+            }
+            else
+            {
+                printf("ring write data:%s\n", usrdata);
+            }
+        }
+        munmap(hdr, hdr->data_offset + hdr->size);
+    }
+
+    if (atoi(argv[2]) == 5)
+    {
+        /*分帧模式下一次read返回多条完整的记录，每条记录前面是4字节的长度*/
+        retvalue = read(fd, batchbuf, sizeof(batchbuf));
+        if (retvalue < 0)
+        {
+            printf("read file %s failed\n", filename);
+        }
+        for (off = 0; off + (int)sizeof(reclen) <= retvalue; off += sizeof(reclen) + reclen)
+        {
+            memcpy(&reclen, batchbuf + off, sizeof(reclen));
+            printf("record %u bytes:%.*s\n", reclen, (int)reclen, batchbuf + off + sizeof(reclen));
+        }
+    }
+
     /*关闭设备*/
     retvalue = close(fd);
     if (retvalue < 0)
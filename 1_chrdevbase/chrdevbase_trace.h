@@ -0,0 +1,90 @@
+/*
+chrdevbase的tracepoint，关闭时只有一条不跳转的分支，可以在数据通路上常开
+使用方法：
+echo 1 > /sys/kernel/debug/tracing/events/chrdevbase/enable
+cat /sys/kernel/debug/tracing/trace_pipe
+*/
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM chrdevbase
+
+#if !defined(_CHRDEVBASE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _CHRDEVBASE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*open：次设备号、工作模式、打开标志和返回值*/
+TRACE_EVENT(chrdevbase_open,
+    TP_PROTO(int minor, int mode, unsigned int flags, int ret),
+    TP_ARGS(minor, mode, flags, ret),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(int, mode)
+        __field(unsigned int, flags)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->mode = mode;
+        __entry->flags = flags;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%d mode=%d flags=0x%x ret=%d",
+              __entry->minor, __entry->mode, __entry->flags, __entry->ret)
+);
+
+/*read/write：次设备号、请求的字节数、返回值（字节数或错误码）和耗时*/
+DECLARE_EVENT_CLASS(chrdevbase_io,
+    TP_PROTO(int minor, size_t count, ssize_t ret, u64 ns),
+    TP_ARGS(minor, count, ret, ns),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+        __field(u64, ns)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->count = count;
+        __entry->ret = ret;
+        __entry->ns = ns;
+    ),
+    TP_printk("minor=%d count=%zu ret=%zd ns=%llu",
+              __entry->minor, __entry->count, __entry->ret, __entry->ns)
+);
+
+DEFINE_EVENT(chrdevbase_io, chrdevbase_read,
+    TP_PROTO(int minor, size_t count, ssize_t ret, u64 ns),
+    TP_ARGS(minor, count, ret, ns)
+);
+
+DEFINE_EVENT(chrdevbase_io, chrdevbase_write,
+    TP_PROTO(int minor, size_t count, ssize_t ret, u64 ns),
+    TP_ARGS(minor, count, ret, ns)
+);
+
+/*release：次设备号和本文件描述符一共读写的字节数*/
+TRACE_EVENT(chrdevbase_release,
+    TP_PROTO(int minor, u64 read_bytes, u64 write_bytes),
+    TP_ARGS(minor, read_bytes, write_bytes),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(u64, read_bytes)
+        __field(u64, write_bytes)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->read_bytes = read_bytes;
+        __entry->write_bytes = write_bytes;
+    ),
+    TP_printk("minor=%d read_bytes=%llu write_bytes=%llu",
+              __entry->minor, __entry->read_bytes, __entry->write_bytes)
+);
+
+#endif /* _CHRDEVBASE_TRACE_H */
+
+/*头文件不在内核的include/trace/events中，告诉define_trace.h到模块目录下查找*/
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE chrdevbase_trace
+#include <trace/define_trace.h>
@@ -6,6 +6,7 @@
 #include <linux/module.h>
 #include <linux/errno.h>
 #include <linux/gpio.h>
+#include <linux/spinlock.h>
 #include <asm/mach/map.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
@@ -34,24 +35,41 @@ static void __iomem *SW_PAD_GPIO1_IO03;
 static void __iomem *GPIO1_DR; 
 static void __iomem *GPIO1_GDIR;
 
+/*
+GPIO1_DR的影子寄存器：数据寄存器只由本驱动写入，它的值总是等于最后一次写入的值
+翻转led时直接修改影子再写入一次，不需要先readl，省掉一次不经过cache的MMIO读
+所有写GPIO1_DR的地方都必须持有gpio1_dr_lock，否则并发的写会互相覆盖
+*/
+static u32 gpio1_dr_shadow;
+static DEFINE_SPINLOCK(gpio1_dr_lock);
+
+/*
+描述：持锁修改影子寄存器并写入GPIO1_DR
+参数：clear：要清零的位
+      set：要置1的位
+return：无
+*/
+static void gpio1_dr_update(u32 clear, u32 set)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&gpio1_dr_lock, flags);
+    gpio1_dr_shadow = (gpio1_dr_shadow & ~clear) | set;
+    writel(gpio1_dr_shadow, GPIO1_DR);
+    spin_unlock_irqrestore(&gpio1_dr_lock, flags);
+}
+
 /*控制LED灯*/
 void led_switch(uint8_t sta)
 {
-    uint32_t val = 0;
     if (sta == LED_ON)
     {
-        /*读取数据寄存器的值*/
-        val = readl(GPIO1_DR);
-        /*1 << 3，就是将1左移3位，得到0000 1000，~(1 << 3)，即为1111 0111*/
-        val &= ~(1 << 3); //val &= 1111 0111，按位与操作，将第3位置0
-        /*将数据写入数据寄存器*/
-        writel(val, GPIO1_DR);
+        /*1 << 3，就是将1左移3位，得到0000 1000，将第3位置0，点亮led*/
+        gpio1_dr_update(1 << 3, 0);
     }
     else if (sta == LED_OFF)
     {
-        val = readl(GPIO1_DR);
-        val |= (1 << 3); //val |= 0000 1000，按位或操作，将第3位置1
-        writel(val, GPIO1_DR);
+        gpio1_dr_update(0, 1 << 3); //将第3位置1，关闭led
     }
 }
 
@@ -146,10 +164,9 @@ static int __init led_init(void)
     val |= (1 << 3);  //设置
     writel(val, GPIO1_GDIR);
 
-    /*5. 默认关闭LED灯*/
-    val = readl(GPIO1_DR);
-    val |= (1 << 3); //设置 bit3 置1 默认关闭led
-    writel(val, GPIO1_DR);
+    /*5. 默认关闭LED灯，只在这里读一次数据寄存器，之后的修改都基于影子寄存器*/
+    gpio1_dr_shadow = readl(GPIO1_DR);
+    gpio1_dr_update(0, 1 << 3); //设置 bit3 置1 默认关闭led
 
     /*6. 注册字符设备驱动*/
     retvalue = register_chrdev(LED_MAJOR, LED_NAME, &led_fops);
@@ -5,9 +5,197 @@
 #include "fcntl.h"
 #include "stdlib.h"
 #include "string.h"
+#include "time.h"
+
+/*
+ * 基准测试：./ledApp bench [-n 次数] [-l 回环gpio的value文件] <设备>...
+ * 依次对每个设备做翻转循环，每个设备输出一行CSV。
+ * 2_led、3_newchrled、4_dtsled、5_gpioled的驱动都接受一个字节的0/1写入，
+ * 所以同一个程序可以比较/dev/led、/dev/newchrled、/dev/dtsled、/dev/gpioled。
+ * -l 指定一根与LED引脚短接的输入gpio(或gpio-sim的线)，例如
+ * /sys/class/gpio/gpio5/value，每次写之后读回电平，统计引脚实际发生的跳变次数。
+ */
+#define BENCH_WARMUP 100 /* 不计入统计的预热次数 */
 
 #define LEDOFF 0
 #define LEDON 1
+
+/*
+ * @description : 获取单调时钟
+ * @return : 当前时间，单位纳秒
+ */
+static unsigned long long bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * @description : 读回环输入的当前电平
+ * @param - fd : value文件描述符
+ * @return : 0或1；-1 失败
+ */
+static int bench_sample(int fd)
+{
+    char c;
+
+    /* sysfs的value文件每次都要从头读 */
+    if (pread(fd, &c, 1, 0) != 1)
+    {
+        return -1;
+    }
+    return c == '1';
+}
+
+/* qsort比较函数 */
+static int bench_cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * @description : 对一个设备做翻转测试并输出一行CSV
+ * @param - filename : 设备文件
+ * @param - iters : 计时的翻转次数
+ * @param - loopfd : 回环输入的value文件，-1表示不统计跳变
+ * @param - lat : 保存每次write耗时的数组，至少iters个元素
+ * @return : 0 成功;其他 失败
+ */
+static int bench_device(const char *filename, long iters, int loopfd, unsigned long long *lat)
+{
+    unsigned char databuf[1] = {LEDOFF};
+    unsigned long long start, total = 0;
+    long i, transitions = -1, misses = 0;
+    int fd, level = -1, now;
+
+    fd = open(filename, O_RDWR);
+    if (fd < 0)
+    {
+        printf("# file %s open failed!\r\n", filename);
+        return -1;
+    }
+
+    for (i = 0; i < BENCH_WARMUP; i++)
+    {
+        databuf[0] = !databuf[0];
+        if (write(fd, databuf, sizeof(databuf)) < 0)
+        {
+            printf("# %s write failed!\r\n", filename);
+            close(fd);
+            return -1;
+        }
+    }
+    if (loopfd >= 0)
+    {
+        transitions = 0;
+        level = bench_sample(loopfd);
+    }
+
+    for (i = 0; i < iters; i++)
+    {
+        databuf[0] = !databuf[0];
+        start = bench_now_ns();
+        if (write(fd, databuf, sizeof(databuf)) < 0)
+        {
+            printf("# %s write failed!\r\n", filename);
+            close(fd);
+            return -1;
+        }
+        lat[i] = bench_now_ns() - start;
+        total += lat[i];
+
+        /* 读回环不计入write耗时；读回的电平没变说明这次写没有到达引脚 */
+        if (loopfd >= 0)
+        {
+            now = bench_sample(loopfd);
+            if (now >= 0 && level >= 0 && now != level)
+            {
+                transitions++;
+            }
+            else
+            {
+                misses++;
+            }
+            level = now;
+        }
+    }
+    close(fd);
+
+    qsort(lat, iters, sizeof(*lat), bench_cmp_ull);
+    printf("%s,%ld,%.0f,%llu,%llu,%llu,%llu,%ld,%ld\n",
+           filename, iters, total ? (double)iters * 1000000000.0 / total : 0.0,
+           lat[(iters - 1) * 50 / 100], lat[(iters - 1) * 99 / 100],
+           lat[(iters - 1) * 999 / 1000], lat[iters - 1],
+           transitions, loopfd >= 0 ? misses : -1L);
+    fflush(stdout);
+    return 0;
+}
+
+/*
+ * @description : 基准测试入口
+ * @param - argc : argv 数组元素个数
+ * @param - argv : 具体参数，argv[1]为"bench"
+ * @return : 0 成功;其他 失败
+ */
+static int bench_main(int argc, char *argv[])
+{
+    unsigned long long *lat;
+    long iters = 100000;
+    int loopfd = -1, opt, i, ret = 0;
+
+    /* 从"bench"开始解析选项 */
+    while ((opt = getopt(argc - 1, argv + 1, "n:l:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            iters = atol(optarg);
+            break;
+        case 'l':
+            loopfd = open(optarg, O_RDONLY);
+            if (loopfd < 0)
+            {
+                printf("file %s open failed!\r\n", optarg);
+                return -1;
+            }
+            break;
+        default:
+            printf("Usage:%s bench [-n iters] [-l gpio value file] <dev>...\r\n", argv[0]);
+            return -1;
+        }
+    }
+    if (iters <= 0 || optind + 1 >= argc)
+    {
+        printf("Usage:%s bench [-n iters] [-l gpio value file] <dev>...\r\n", argv[0]);
+        return -1;
+    }
+
+    lat = malloc(sizeof(*lat) * iters);
+    if (lat == NULL)
+    {
+        printf("out of memory\r\n");
+        return -1;
+    }
+
+    /* transitions和misses为-1表示没有指定回环输入 */
+    printf("dev,iters,toggles_s,p50_ns,p99_ns,p999_ns,max_ns,transitions,misses\n");
+    for (i = optind + 1; i < argc; i++)
+    {
+        ret |= bench_device(argv[i], iters, loopfd, lat);
+    }
+
+    free(lat);
+    if (loopfd >= 0)
+    {
+        close(loopfd);
+    }
+    return ret;
+}
 /*
  * @description : main 主程序
  * @param - argc : argv 数组元素个数
@@ -19,6 +207,10 @@ int main(int argc, char *argv[])
     int fd, retvalue;
     char *filename;
     unsigned char databuf[1];
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0)
+    {
+        return bench_main(argc, argv);
+    }
     if (argc != 3)
     {
         printf("Error Usage!\r\n");
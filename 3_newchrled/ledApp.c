@@ -5,9 +5,82 @@
 #include "fcntl.h"
 #include "stdlib.h"
 #include "string.h"
+#include "time.h"
+#include "sys/ioctl.h"
+#include "linux/ioctl.h"
+#include "linux/types.h"
 
 #define LEDOFF 0
 #define LEDON 1
+
+/*与newchrled.c中的定义保持一致*/
+#define NEWCHRLED_IOC_MAGIC  0xEA
+#define NEWCHRLED_IOC_BATCH  (_IOWR(NEWCHRLED_IOC_MAGIC, 0x1, struct newchrled_batch))
+#define NEWCHRLED_OP_SET      0
+#define NEWCHRLED_OP_CLEAR    1
+#define NEWCHRLED_OP_TOGGLE   2
+#define NEWCHRLED_OP_DELAY_US 3
+
+struct newchrled_cmd
+{
+    __u16 op;
+    __u16 pad;
+    __u32 arg;
+};
+
+struct newchrled_batch
+{
+    __u64 cmds;
+    __u32 count;
+    __u32 applied;
+};
+
+/*
+ * @description : 一次ioctl让led翻转count次，每次翻转后等待delay_us微秒，最后熄灭
+ * @param - fd : 设备文件描述符
+ * @param - count : 翻转次数
+ * @param - delay_us : 每次翻转后的等待时间，0表示不等待
+ * @return : 0 成功;其他 失败
+ */
+static int batch_toggle(int fd, int count, int delay_us)
+{
+    struct newchrled_batch batch;
+    struct newchrled_cmd *cmds;
+    struct timespec start, end;
+    int i, n = 0, ret;
+
+    cmds = calloc(count * 2 + 1, sizeof(*cmds));
+    if (cmds == NULL)
+    {
+        return -1;
+    }
+    for (i = 0; i < count; i++)
+    {
+        cmds[n++].op = NEWCHRLED_OP_TOGGLE;
+        if (delay_us > 0)
+        {
+            cmds[n].op = NEWCHRLED_OP_DELAY_US;
+            cmds[n++].arg = delay_us;
+        }
+    }
+    cmds[n++].op = NEWCHRLED_OP_CLEAR;
+
+    batch.cmds = (unsigned long)cmds;
+    batch.count = n;
+    batch.applied = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = ioctl(fd, NEWCHRLED_IOC_BATCH, &batch);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(cmds);
+
+    if (ret < 0)
+    {
+        return -1;
+    }
+    printf("applied %d of %d commands in %ld us\r\n", ret, n,
+           (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000);
+    return 0;
+}
 /*
  * @description : main 主程序
  * @param - argc : argv 数组元素个数
@@ -19,7 +92,7 @@ int main(int argc, char *argv[])
     int fd, retvalue;
     char *filename;
     unsigned char databuf[1];
-    if (argc != 3)
+    if (argc != 3 && !(argc == 5 && strcmp(argv[2], "batch") == 0))
     {
         printf("Error Usage!\r\n");
         return -1;
@@ -32,6 +105,18 @@ int main(int argc, char *argv[])
         printf("file %s open failed!\r\n", argv[1]);
         return -1;
     }
+    /* ./ledApp /dev/newchrled batch <次数> <间隔微秒>：所有操作在一次ioctl中完成 */
+    if (argc == 5)
+    {
+        retvalue = batch_toggle(fd, atoi(argv[3]), atoi(argv[4]));
+        if (retvalue < 0)
+        {
+            printf("LED Batch Failed!\r\n");
+        }
+        close(fd);
+        return retvalue;
+    }
+
     /* 要执行的操作：打开或关闭 */
     databuf[0] = atoi(argv[2]); 
     
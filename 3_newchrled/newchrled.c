@@ -8,6 +8,9 @@
 #include <linux/gpio.h>
 #include <linux/cdev.h>
 #include <linux/device.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
 #include <asm/mach/map.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
@@ -18,6 +21,36 @@
 #define LEDOFF 0                      /*关灯*/
 #define LEDON  1                      /*开灯*/
 
+/*ioctl命令：一次系统调用执行一组led操作*/
+#define NEWCHRLED_IOC_MAGIC  0xEA
+#define NEWCHRLED_IOC_BATCH  (_IOWR(NEWCHRLED_IOC_MAGIC, 0x1, struct newchrled_batch))
+
+/*批量命令的操作码*/
+#define NEWCHRLED_OP_SET      0 /*点亮*/
+#define NEWCHRLED_OP_CLEAR    1 /*熄灭*/
+#define NEWCHRLED_OP_TOGGLE   2 /*翻转*/
+#define NEWCHRLED_OP_DELAY_US 3 /*等待arg微秒*/
+
+#define NEWCHRLED_BATCH_CHUNK    64      /*每次从用户空间拷贝的命令数*/
+#define NEWCHRLED_MAX_DELAY_US   1000000 /*单条延时命令的上限*/
+#define NEWCHRLED_UDELAY_MAX_US  20      /*不超过这个时间的延时用忙等，更长的延时可被信号打断地睡眠*/
+
+/*一条命令，结构体与ledApp.c中的定义保持一致*/
+struct newchrled_cmd
+{
+    __u16 op;  /*操作码*/
+    __u16 pad;
+    __u32 arg; /*NEWCHRLED_OP_DELAY_US的微秒数，其他操作不使用*/
+};
+
+/*NEWCHRLED_IOC_BATCH的参数*/
+struct newchrled_batch
+{
+    __u64 cmds;    /*用户空间的命令数组地址*/
+    __u32 count;   /*命令数*/
+    __u32 applied; /*返回：执行了的命令数*/
+};
+
 /*寄存器物理地址*/
 #define CCM_CCGR1_BASE              (0X020C406C)
 #define SW_MUX_GPIO1_IO03_BASE      (0X020E0068)
@@ -47,22 +80,151 @@ struct newchrled_dev
 
 struct newchrled_dev newchrled;
 
+/*GPIO1_DR的影子寄存器，只由本驱动写入，翻转时不需要先readl，修改时持有gpio1_dr_lock*/
+static u32 gpio1_dr_shadow;
+static DEFINE_SPINLOCK(gpio1_dr_lock);
+
+/*修改影子寄存器中clear、set和toggle对应的位，再写入GPIO1_DR*/
+static void gpio1_dr_update(u32 clear, u32 set, u32 toggle)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&gpio1_dr_lock, flags);
+    gpio1_dr_shadow = ((gpio1_dr_shadow & ~clear) | set) ^ toggle;
+    writel(gpio1_dr_shadow, GPIO1_DR);
+    spin_unlock_irqrestore(&gpio1_dr_lock, flags);
+}
+
 /*led的打开与关闭*/
 void led_switch(uint8_t sta)
 {
-    uint32_t val = 0;
     if(sta == LEDON)
     {
-        val = readl(GPIO1_DR);
-        val &= ~(1 << 3);     //bit3清零，点亮
-        writel(val, GPIO1_DR);
+        gpio1_dr_update(1 << 3, 0, 0);     //bit3清零，点亮
     }
     else if(sta == LEDOFF)
     {
-        val = readl(GPIO1_DR);
-        val |= (1 << 3);      //bit3置1，熄灭
-        writel(val, GPIO1_DR);
+        gpio1_dr_update(0, 1 << 3, 0);     //bit3置1，熄灭
+    }
+}
+
+/*
+描述：执行一条批量命令
+参数：cmd：命令
+return：0成功；-EINVAL表示命令无效；-ERESTARTSYS表示延时被信号打断
+*/
+static int newchrled_exec(const struct newchrled_cmd *cmd)
+{
+    ktime_t expires;
+
+    switch (cmd->op)
+    {
+    case NEWCHRLED_OP_SET:
+        led_switch(LEDON);
+        break;
+    case NEWCHRLED_OP_CLEAR:
+        led_switch(LEDOFF);
+        break;
+    case NEWCHRLED_OP_TOGGLE:
+        gpio1_dr_update(0, 0, 1 << 3);
+        break;
+    case NEWCHRLED_OP_DELAY_US:
+        if (cmd->arg > NEWCHRLED_MAX_DELAY_US)
+        {
+            return -EINVAL;
+        }
+        if (cmd->arg <= NEWCHRLED_UDELAY_MAX_US)
+        {
+            udelay(cmd->arg);
+        }
+        else
+        {
+            /*usleep_range的睡眠不可打断，1秒的延时会让进程在这段时间内收不到信号*/
+            expires = ns_to_ktime((u64)cmd->arg * NSEC_PER_USEC);
+            set_current_state(TASK_INTERRUPTIBLE);
+            if (schedule_hrtimeout_range(&expires, cmd->arg / 8 * NSEC_PER_USEC, HRTIMER_MODE_REL) != 0)
+            {
+                return -ERESTARTSYS;
+            }
+        }
+        break;
+    default:
+        return -EINVAL;
     }
+    return 0;
+}
+
+/*
+描述：执行用户空间的一组命令，每次拷贝NEWCHRLED_BATCH_CHUNK条，遇到无效命令或信号时停止，
+      每条延时命令之后都检查信号，被打断的延时命令不计入applied
+参数：batch：用户空间的struct newchrled_batch
+return：执行了的命令数，同时写回batch->applied；一条都没有执行时返回错误码
+*/
+static long newchrled_batch(struct newchrled_batch __user *ubatch)
+{
+    struct newchrled_cmd cmds[NEWCHRLED_BATCH_CHUNK];
+    struct newchrled_batch batch;
+    const struct newchrled_cmd __user *ucmds;
+    unsigned int applied = 0, n, i;
+    int ret = 0;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+    {
+        return -EFAULT;
+    }
+    ucmds = (const struct newchrled_cmd __user *)(unsigned long)batch.cmds;
+
+    while (applied < batch.count && ret == 0)
+    {
+        n = min_t(unsigned int, batch.count - applied, NEWCHRLED_BATCH_CHUNK);
+        if (copy_from_user(cmds, ucmds + applied, n * sizeof(cmds[0])))
+        {
+            ret = -EFAULT;
+            break;
+        }
+        for (i = 0; i < n; i++)
+        {
+            ret = newchrled_exec(&cmds[i]);
+            if (ret < 0)
+            {
+                break;
+            }
+            applied++;
+
+            /*忙等的短延时也可能累积很久，每条延时命令之后检查信号*/
+            if (cmds[i].op == NEWCHRLED_OP_DELAY_US && applied < batch.count && signal_pending(current))
+            {
+                ret = -ERESTARTSYS;
+                break;
+            }
+        }
+
+        /*很长的命令序列允许被信号打断*/
+        if (ret == 0 && applied < batch.count && signal_pending(current))
+        {
+            ret = -ERESTARTSYS;
+        }
+    }
+
+    if (applied == 0 && ret < 0)
+    {
+        return ret == -ERESTARTSYS ? -EINTR : ret;
+    }
+    if (put_user(applied, &ubatch->applied))
+    {
+        return -EFAULT;
+    }
+    return applied;
+}
+
+/*ioctl*/
+static long newchrled_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    if (cmd != NEWCHRLED_IOC_BATCH)
+    {
+        return -ENOTTY;
+    }
+    return newchrled_batch((struct newchrled_batch __user *)arg);
 }
 
 /*打开设备*/
@@ -86,9 +248,13 @@ static ssize_t newchrled_write(struct file *filp, const char __user *buf, size_t
     unsigned char databuf[1];
     unsigned char ledstat;
     
-    /*拷贝从用户空间传递的数据到内核空间*/
-    retvalue = copy_from_user(databuf, buf, cnt);
-    if(retvalue < 0)
+    /*拷贝从用户空间传递的数据到内核空间，只使用第一个字节，多个操作请用NEWCHRLED_IOC_BATCH*/
+    if (cnt == 0)
+    {
+        return 0;
+    }
+    retvalue = copy_from_user(databuf, buf, sizeof(databuf));
+    if(retvalue != 0)
     {
         printk("kernel write failed!\r\n");
         return -EFAULT;
@@ -103,7 +269,7 @@ static ssize_t newchrled_write(struct file *filp, const char __user *buf, size_t
     {
         led_switch(LEDOFF);
     }
-    return 0;
+    return cnt;
 }
 
 /*关闭/释放设备*/
@@ -118,6 +284,7 @@ static struct file_operations newchrled_fops = {
     .open = newchrled_open,
     .read = newchrled_read,
     .write = newchrled_write,
+    .unlocked_ioctl = newchrled_unlocked_ioctl,
     .release = newchrled_release,
 };
 
@@ -151,10 +318,9 @@ static int __init led_init(void)
     val |= (1 << 3);        //bit3置1
     writel(val, GPIO1_GDIR);
 
-    /*默认关闭LED*/
-    val = readl(GPIO1_DR);
-    val |= (1 << 3);        //bit3置1
-    writel(val, GPIO1_DR);
+    /*默认关闭LED，只在这里读一次数据寄存器来初始化影子寄存器*/
+    gpio1_dr_shadow = readl(GPIO1_DR);
+    gpio1_dr_update(0, 1 << 3, 0);        //bit3置1
 
     /*注册字符设备驱动*/
     if (newchrled.major) //如果已经定义了设备号
@@ -10,6 +10,9 @@
 #include <linux/device.h>
 #include <linux/of.h>
 #include <linux/of_address.h>
+#include <linux/regmap.h>
+#include <linux/mm.h>
+#include <linux/capability.h>
 #include <asm/mach/map.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
@@ -19,6 +22,25 @@
 #define dtsled_NAME "dtsled" /*设备名*/
 #define LEDOFF 0                /*关灯*/
 #define LEDON 1                 /*开灯*/
+#define DTSLED_MAX_LEDS 8       /*最多支持的led个数*/
+#define DTSLED_MAX_REGS (DTSLED_MAX_LEDS * 5) /*每个led最多用到时钟门控、复用、电气属性、DR、GDIR五个寄存器*/
+
+/*ioctl命令*/
+#define DTSLED_IOC_MAGIC       0xEB
+#define DTSLED_IOC_GET_MAPINFO (_IOWR(DTSLED_IOC_MAGIC, 0x1, struct dtsled_mapinfo)) /*获取mmap后某个led的数据寄存器的位置和位*/
+
+/*
+mmap的offset为led编号乘以页大小，映射的是这个led的GPIO数据寄存器所在的一页寄存器，
+用户空间通过dr_offset找到数据寄存器，直接读写pin_mask对应的位；同一组GPIO的led映射到同一页
+该结构体与ledApp.c中的定义保持一致
+*/
+struct dtsled_mapinfo
+{
+    __u32 led;        /*输入：led编号*/
+    __u32 dr_offset;  /*数据寄存器相对于映射起始地址的偏移*/
+    __u32 pin_mask;   /*led对应的位*/
+    __u32 active_low; /*1表示该位清零时点亮*/
+};
 
 /*通过设备树获取物理地址，不需要再驱动中定义*/
 
@@ -29,12 +51,59 @@
 // #define GPIO1_DR_BASE (0X0209C000)
 // #define GPIO1_GDIR_BASE (0X0209C004)
 
-/*映射后的寄存器虚拟地址指针*/
-static void __iomem *IMX6U_CCM_CCGR1;
-static void __iomem *SW_MUX_GPIO1_IO03;
-static void __iomem *SW_PAD_GPIO1_IO03;
-static void __iomem *GPIO1_DR;
-static void __iomem *GPIO1_GDIR;
+/*
+每个led在设备树中是alphaled下的一个子节点：
+    led0 {
+        gpio-bank = <0x0209C000>;      GPIO组的物理地址，DR在偏移0，GDIR在偏移4
+        gpio-pin = <3>;                引脚在组内的编号
+        pinmux = <0x020E0068 5>;       复用寄存器的物理地址和值
+        pinpad = <0x020E02F4 0x10B0>;  电气属性寄存器的物理地址和值
+        clock-gate = <0x020C406C 26>;  可选，CCM_CCGRx的物理地址和两位门控的起始位
+        active-low;                    可选，低电平点亮
+    };
+没有子节点时按老的reg属性（CCGR1、MUX、PAD、DR、GDIR）使用GPIO1_IO03
+
+gpio-bank可以是任意一组GPIO，同一组的其他引脚可能由gpiolib的使用者（例如6_beep）修改，
+所以DR和GDIR在regmap中为volatile，不缓存，开关led时在regmap的锁内从硬件读-改-写
+这把锁只串行化本驱动的访问，gpiolib修改同一组引脚时仍然是两次独立的读-改-写，
+共用一组GPIO的引脚应当避免同时被两边频繁修改
+*/
+
+/*设备树中一个led的配置，只在初始化时使用*/
+struct dtsled_pincfg
+{
+    u32 dr;         /*数据寄存器物理地址*/
+    u32 gdir;       /*方向寄存器物理地址*/
+    u32 pin;        /*引脚编号*/
+    u32 mux[2];     /*复用寄存器物理地址和值*/
+    u32 pad[2];     /*电气属性寄存器物理地址和值*/
+    u32 clk[2];     /*时钟门控寄存器物理地址和起始位，地址为0表示不需要打开时钟*/
+    bool active_low;
+};
+
+/*
+初始化时为每个led预先算好的描述符，开关led时查表后只需要一次读-改-写，不再做任何解析
+dr为数据寄存器在regmap中的编号，同一组GPIO的led共用一个编号
+*/
+struct dtsled_led
+{
+    unsigned int dr; /*数据寄存器编号*/
+    u32 mask;        /*引脚在数据寄存器中对应的位*/
+    u32 on;          /*点亮时该位的值*/
+    u32 off;         /*熄灭时该位的值*/
+};
+
+/*
+regmap中的寄存器按物理地址去重后依次编号，每个编号对应一个ioremap后的地址
+这些寄存器分散在CCM、IOMUXC和各组GPIO里，所以不用regmap_init_mmio，而是按编号转到各自映射后的地址
+*/
+static void __iomem *dtsled_regs[DTSLED_MAX_REGS];
+static u32 dtsled_reg_phys[DTSLED_MAX_REGS];
+static bool dtsled_reg_shared[DTSLED_MAX_REGS]; /*其他驱动也会修改的寄存器，在regmap中为volatile，不缓存*/
+static unsigned int dtsled_nregs;
+
+/*初始化时解析出的每个led的配置*/
+static struct dtsled_pincfg dtsled_cfg[DTSLED_MAX_LEDS] __initdata;
 
 /*设备信息结构体*/
 struct dtsled_dev
@@ -48,27 +117,202 @@ struct dtsled_dev
 
     /*使用OF函数获取设备树节点中的属性值*/
     struct device_node *nd; /*设备树节点*/
+    struct regmap *regmap;  /*所有寄存器都通过regmap访问，带寄存器缓存*/
+
+    struct dtsled_led leds[DTSLED_MAX_LEDS]; /*每个led的描述符*/
+    int nleds;                               /*led个数*/
 };
 
 struct dtsled_dev dtsled; /*led设备*/
 
 
-/*led的打开与关闭*/
-void led_switch(uint8_t sta)
+/*regmap读寄存器的回调，reg为dtsled_reg_add返回的编号*/
+static int dtsled_reg_read(void *context, unsigned int reg, unsigned int *val)
 {
-    uint32_t val = 0;
-    if (sta == LEDON)
+    *val = readl(dtsled_regs[reg]);
+    return 0;
+}
+
+/*regmap写寄存器的回调*/
+static int dtsled_reg_write(void *context, unsigned int reg, unsigned int val)
+{
+    writel(val, dtsled_regs[reg]);
+    return 0;
+}
+
+/*regmap缓存的初值，初始化时从硬件读取*/
+static struct reg_default dtsled_reg_defaults[DTSLED_MAX_REGS];
+
+/*共享的寄存器不缓存，每次都读写硬件*/
+static bool dtsled_reg_volatile(struct device *dev, unsigned int reg)
+{
+    return dtsled_reg_shared[reg];
+}
+
+/*
+使用平坦缓存：读直接命中缓存，regmap_update_bits在值不变时不写寄存器
+只有led引脚自己的复用和电气属性寄存器由本驱动独占，可以缓存，要求设备树中没有pinctrl节点占用这些引脚
+CCM_CCGRx里还有其他模块的时钟门控，由时钟框架修改；GPIO的DR和GDIR由同一组的其他引脚共用，都标记为volatile
+debugfs下regmap/dtsled/registers从缓存输出被缓存的寄存器，不产生MMIO访问
+寄存器个数在解析完设备树以后才知道，max_register和num_reg_defaults在初始化时填写
+*/
+static struct regmap_config dtsled_regmap_config = {
+    .reg_bits = 32,
+    .val_bits = 32,
+    .reg_stride = 1,
+    .reg_read = dtsled_reg_read,
+    .reg_write = dtsled_reg_write,
+    .fast_io = true,
+    .cache_type = REGCACHE_FLAT,
+    .reg_defaults = dtsled_reg_defaults,
+    .volatile_reg = dtsled_reg_volatile,
+};
+
+/*
+把物理地址为phys的寄存器加入regmap，同一个寄存器只映射一次，返回它在regmap中的编号
+shared为true表示其他驱动也会修改这个寄存器
+*/
+static int __init dtsled_reg_add(u32 phys, bool shared)
+{
+    unsigned int i;
+
+    for (i = 0; i < dtsled_nregs; i++)
+    {
+        if (dtsled_reg_phys[i] == phys)
+        {
+            dtsled_reg_shared[i] |= shared;
+            return i;
+        }
+    }
+    if (dtsled_nregs == DTSLED_MAX_REGS)
+    {
+        return -ENOSPC;
+    }
+    dtsled_regs[i] = ioremap(phys, 4);
+    if (dtsled_regs[i] == NULL)
     {
-        val = readl(GPIO1_DR);
-        val &= ~(1 << 3); // bit3清零，点亮
-        writel(val, GPIO1_DR);
+        return -ENOMEM;
     }
-    else if (sta == LEDOFF)
+    dtsled_reg_phys[i] = phys;
+    dtsled_reg_shared[i] = shared;
+    dtsled_nregs++;
+    return i;
+}
+
+/*取消所有寄存器的映射*/
+static void dtsled_unmap_regs(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < dtsled_nregs; i++)
     {
-        val = readl(GPIO1_DR);
-        val |= (1 << 3); // bit3置1，熄灭
-        writel(val, GPIO1_DR);
+        iounmap(dtsled_regs[i]);
     }
+    dtsled_nregs = 0;
+}
+
+/*从led子节点读取配置*/
+static int __init dtsled_parse_led(struct device_node *np, struct dtsled_pincfg *cfg)
+{
+    if (of_property_read_u32(np, "gpio-bank", &cfg->dr) < 0 ||
+        of_property_read_u32(np, "gpio-pin", &cfg->pin) < 0 ||
+        of_property_read_u32_array(np, "pinmux", cfg->mux, 2) < 0 ||
+        of_property_read_u32_array(np, "pinpad", cfg->pad, 2) < 0 ||
+        cfg->pin >= 32)
+    {
+        printk("%s: bad led properties!\r\n", np->name);
+        return -EINVAL;
+    }
+    cfg->gdir = cfg->dr + 4;
+    if (of_property_read_u32_array(np, "clock-gate", cfg->clk, 2) < 0)
+    {
+        cfg->clk[0] = 0;
+    }
+    else if (cfg->clk[1] > 30 || cfg->clk[1] % 2)
+    {
+        printk("%s: bad clock-gate shift!\r\n", np->name);
+        return -EINVAL;
+    }
+    cfg->active_low = of_property_read_bool(np, "active-low");
+    return 0;
+}
+
+/*没有led子节点时，按alphaled节点reg属性中的五个寄存器使用GPIO1_IO03*/
+static int __init dtsled_parse_legacy(struct device_node *np, struct dtsled_pincfg *cfg)
+{
+    struct resource res[5];
+    int i;
+
+    for (i = 0; i < 5; i++)
+    {
+        if (of_address_to_resource(np, i, &res[i]) < 0)
+        {
+            printk("reg %d read failed!\r\n", i);
+            return -EINVAL;
+        }
+    }
+    cfg->clk[0] = res[0].start;
+    cfg->clk[1] = 26;
+    cfg->mux[0] = res[1].start;
+    cfg->mux[1] = 5;
+    cfg->pad[0] = res[2].start;
+    cfg->pad[1] = 0x10B0;
+    cfg->dr = res[3].start;
+    cfg->gdir = res[4].start;
+    cfg->pin = 3;
+    cfg->active_low = true;
+    return 0;
+}
+
+/*映射一个led用到的寄存器并生成描述符，返回0成功*/
+static int __init dtsled_led_map(const struct dtsled_pincfg *cfg, struct dtsled_led *led)
+{
+    int ret;
+    u32 phys[4] = {cfg->gdir, cfg->mux[0], cfg->pad[0], cfg->clk[0]};
+    bool shared[4] = {true, false, false, true};
+    int i, n = cfg->clk[0] ? 4 : 3;
+
+    ret = dtsled_reg_add(cfg->dr, true);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    led->dr = ret;
+    led->mask = BIT(cfg->pin);
+    led->on = cfg->active_low ? 0 : led->mask;
+    led->off = led->mask ^ led->on;
+
+    /*其他寄存器只在初始化时配置一次，这里只需要先映射好*/
+    for (i = 0; i < n; i++)
+    {
+        ret = dtsled_reg_add(phys[i], shared[i]);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/*通过regmap配置一个led的时钟、复用、电气属性和方向，并熄灭led，寄存器编号由物理地址查到*/
+static void __init dtsled_led_setup(const struct dtsled_pincfg *cfg, const struct dtsled_led *led)
+{
+    int clk = cfg->clk[0] ? dtsled_reg_add(cfg->clk[0], true) : -1;
+
+    if (clk >= 0)
+    {
+        regmap_update_bits(dtsled.regmap, clk, 3 << cfg->clk[1], 3 << cfg->clk[1]);
+    }
+    regmap_write(dtsled.regmap, dtsled_reg_add(cfg->mux[0], false), cfg->mux[1]);
+    regmap_write(dtsled.regmap, dtsled_reg_add(cfg->pad[0], false), cfg->pad[1]);
+    regmap_update_bits(dtsled.regmap, dtsled_reg_add(cfg->gdir, true), led->mask, led->mask);
+    regmap_update_bits(dtsled.regmap, led->dr, led->mask, led->off);
+}
+
+/*led的打开与关闭，查表得到寄存器编号和要写的值，regmap_update_bits在regmap的锁内读-改-写*/
+static void led_switch(const struct dtsled_led *led, uint8_t sta)
+{
+    regmap_update_bits(dtsled.regmap, led->dr, led->mask, sta == LEDON ? led->on : led->off);
 }
 
 /*打开设备*/
@@ -85,29 +329,91 @@ static ssize_t led_read(struct file *filp, char __user *buf, size_t cnt, loff_t
     return 0;
 }
 
-/*向设备写入数据*/
+/*
+向设备写入数据，第i个字节控制第i个led，不是LEDON/LEDOFF的字节保持该led不变
+多出led个数的字节被忽略，但仍然算作已写入，避免应用程序把剩下的字节重新写到第一个led上
+*/
 static ssize_t led_write(struct file *filp, const char __user *buf, size_t cnt, loff_t *offt)
 {
-    int retvalue;
-    unsigned char databuf[1];
-    unsigned char ledstat;
+    struct dtsled_dev *dev = filp->private_data;
+    unsigned char databuf[DTSLED_MAX_LEDS];
+    size_t i, n;
+
+    n = min_t(size_t, cnt, dev->nleds);
 
     /*拷贝从用户空间传递的数据到内核空间*/
-    retvalue = copy_from_user(databuf, buf, cnt);
-    if (retvalue < 0)
+    if (copy_from_user(databuf, buf, n))
     {
         printk("kernel write failed!\r\n");
         return -EFAULT;
     }
 
-    ledstat = databuf[0];
-    if (ledstat == LEDON)
+    for (i = 0; i < n; i++)
     {
-        led_switch(LEDON);
+        if (databuf[i] == LEDON || databuf[i] == LEDOFF)
+        {
+            led_switch(&dev->leds[i], databuf[i]);
+        }
+    }
+    return cnt;
+}
+
+/*ioctl，获取mmap后info.led所在的寄存器和位*/
+static long led_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct dtsled_dev *dev = filp->private_data;
+    struct dtsled_mapinfo info;
+    const struct dtsled_led *led;
+
+    if (cmd != DTSLED_IOC_GET_MAPINFO)
+    {
+        return -ENOTTY;
+    }
+    if (copy_from_user(&info, (void __user *)arg, sizeof(info)))
+    {
+        return -EFAULT;
+    }
+    if (info.led >= dev->nleds)
+    {
+        return -EINVAL;
+    }
+
+    led = &dev->leds[info.led];
+    info.dr_offset = dtsled_reg_phys[led->dr] & ~PAGE_MASK;
+    info.pin_mask = led->mask;
+    info.active_low = led->on == 0;
+    if (copy_to_user((void __user *)arg, &info, sizeof(info)))
+    {
+        return -EFAULT;
+    }
+    return 0;
+}
+
+/*
+mmap，把第vm_pgoff个led的数据寄存器所在的一页寄存器以不经过cache的方式映射到用户空间，用户空间直接写寄存器翻转led，不需要系统调用
+DR在regmap中为volatile，用户空间修改寄存器以后驱动不需要同步缓存
+这一页上还有同一组GPIO的其他寄存器，只允许有CAP_SYS_RAWIO权限的进程映射
+*/
+static int led_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct dtsled_dev *dev = filp->private_data;
+    u32 phys;
+
+    if (!capable(CAP_SYS_RAWIO))
+    {
+        return -EPERM;
     }
-    else if (ledstat == LEDOFF)
+    if (vma->vm_pgoff >= dev->nleds || vma->vm_end - vma->vm_start != PAGE_SIZE)
     {
-        led_switch(LEDOFF);
+        return -EINVAL;
+    }
+    phys = dtsled_reg_phys[dev->leds[vma->vm_pgoff].dr];
+
+    vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+    vma->vm_flags |= VM_IO | VM_DONTEXPAND | VM_DONTDUMP;
+    if (io_remap_pfn_range(vma, vma->vm_start, phys >> PAGE_SHIFT, PAGE_SIZE, vma->vm_page_prot))
+    {
+        return -EAGAIN;
     }
     return 0;
 }
@@ -124,6 +430,8 @@ static struct file_operations dtsled_fops = {
     .open = led_open,
     .read = led_read,
     .write = led_write,
+    .unlocked_ioctl = led_unlocked_ioctl,
+    .mmap = led_mmap,
     .release = led_release,
 };
 
@@ -131,8 +439,9 @@ static struct file_operations dtsled_fops = {
 static int __init led_init(void)
 {
     uint32_t val = 0;
-    int ret;
+    int ret, i;
     uint32_t regdata[14];
+    struct device_node *child;
 
     const char *str;
 
@@ -193,23 +502,42 @@ static int __init led_init(void)
     }
 
 
-    /*寄存器地址映射*/
-#if 0
-
-    /*通过of_property_read_u32_array函数获取设备节点的物理地址*/
-    IMX6U_CCM_CCGR1 = ioremap(regdata[0], regdata[1]);
-    SW_MUX_GPIO1_IO03 = ioremap(regdata[2], regdata[3]);
-    SW_PAD_GPIO1_IO03 = ioremap(regdata[4], regdata[5]);
-    GPIO1_DR = ioremap(regdata[6], regdata[7]);
-    GPIO1_GDIR = ioremap(regdata[8], regdata[9]);
-#else
-    /*通过设备节点指针获取设备节点的物理地址*/
-    IMX6U_CCM_CCGR1 = of_iomap(dtsled.nd, 0); 
-    SW_MUX_GPIO1_IO03 = of_iomap(dtsled.nd, 1);
-    SW_PAD_GPIO1_IO03 = of_iomap(dtsled.nd, 2);
-    GPIO1_DR = of_iomap(dtsled.nd, 3);
-    GPIO1_GDIR = of_iomap(dtsled.nd, 4);
-#endif
+    /*5、读取每个led的配置，映射用到的寄存器并生成描述符*/
+    for_each_available_child_of_node(dtsled.nd, child)
+    {
+        if (dtsled.nleds == DTSLED_MAX_LEDS)
+        {
+            printk("too many leds, only %d used!\r\n", DTSLED_MAX_LEDS);
+            of_node_put(child);
+            break;
+        }
+        ret = dtsled_parse_led(child, &dtsled_cfg[dtsled.nleds]);
+        if (ret < 0)
+        {
+            of_node_put(child);
+            goto fail_parse;
+        }
+        dtsled.nleds++;
+    }
+    if (dtsled.nleds == 0)
+    {
+        ret = dtsled_parse_legacy(dtsled.nd, &dtsled_cfg[0]);
+        if (ret < 0)
+        {
+            goto fail_parse;
+        }
+        dtsled.nleds = 1;
+    }
+    for (i = 0; i < dtsled.nleds; i++)
+    {
+        ret = dtsled_led_map(&dtsled_cfg[i], &dtsled.leds[i]);
+        if (ret < 0)
+        {
+            printk("led %d iomap failed!\r\n", i);
+            goto fail_map;
+        }
+    }
+    printk("dtsled: %d leds, %u registers\r\n", dtsled.nleds, dtsled_nregs);
 
     /*
     IMX6U_CCM_CCGR1 = ioremap(CCM_CCGR1_BASE, 4);
@@ -218,55 +546,33 @@ static int __init led_init(void)
     GPIO1_DR = ioremap(GPIO1_DR_BASE, 4);
     GPIO1_GDIR = ioremap(GPIO1_GDIR_BASE, 4);
     */
-    /*2、使能GPIO1时钟*/
-    val = readl(IMX6U_CCM_CCGR1);
-    val &= ~(3 << 26); // 清除以前的设置
-    val |= (3 << 26);  // 设置新值
-    writel(val, IMX6U_CCM_CCGR1);
-
-    /*3、设置GPIO1_IO03复用功能，将其复用为GPIO1_IO03，最后设置IO属性*/
-    writel(5, SW_MUX_GPIO1_IO03);      // 设置复用功能
-    writel(0x10B0, SW_PAD_GPIO1_IO03); // 设置电气属性
-
-    /*4、设置GPIO1_IO03为输出*/
-    val = readl(GPIO1_GDIR);
-    val &= ~(1 << 3); // bit3清零
-    val |= (1 << 3);  // bit3置1
-    writel(val, GPIO1_GDIR);
-
-    /*默认关闭LED*/
-    val = readl(GPIO1_DR);
-    val |= (1 << 3); // bit3置1
-    writel(val, GPIO1_DR);
-
     /*注册字符设备驱动*/
     if (dtsled.major) // 如果已经定义了设备号
     {
         dtsled.devid = MKDEV(dtsled.major, 0);
-        register_chrdev_region(dtsled.devid, dtsled_CNT, dtsled_NAME);
+        ret = register_chrdev_region(dtsled.devid, dtsled_CNT, dtsled_NAME);
     }
     else // 如果没有定义设备号，就向内核申请一个设备号
     {
-        alloc_chrdev_region(&dtsled.devid, 0, dtsled_CNT, dtsled_NAME);
+        ret = alloc_chrdev_region(&dtsled.devid, 0, dtsled_CNT, dtsled_NAME);
         dtsled.major = MAJOR(dtsled.devid);
         dtsled.minor = MINOR(dtsled.devid);
     }
+    if (ret < 0)
+    {
+        printk("dtsled chrdev region failed!\r\n");
+        goto fail_map;
+    }
 
     /*打印设备的主次设备号*/
     printk("dtsled major = %d, minor = %d\r\n", dtsled.major, dtsled.minor);
 
-    /*初始化cdev*/
-    dtsled.cdev.owner = THIS_MODULE;
-    cdev_init(&dtsled.cdev, &dtsled_fops);
-
-    /*添加一个cdev*/
-    cdev_add(&dtsled.cdev, dtsled.devid, dtsled_CNT);
-
     /*创建类*/
     dtsled.class = class_create(THIS_MODULE, dtsled_NAME);
     if (IS_ERR(dtsled.class))
     {
-        return PTR_ERR(dtsled.class);
+        ret = PTR_ERR(dtsled.class);
+        goto fail_class;
     }
 
     /*创建设备*/
@@ -274,24 +580,77 @@ static int __init led_init(void)
 
     if (IS_ERR(dtsled.device))
     {
-        return PTR_ERR(dtsled.device);
+        ret = PTR_ERR(dtsled.device);
+        goto fail_device;
+    }
+
+    /*
+    创建regmap，debugfs目录以设备名命名，所以放在device_create之后
+    平坦缓存没有默认值时会把所有寄存器当成0，这里先读一次硬件作为被缓存寄存器的初值
+    */
+    for (val = 0, i = 0; val < dtsled_nregs; val++)
+    {
+        if (!dtsled_reg_shared[val])
+        {
+            dtsled_reg_defaults[i].reg = val;
+            dtsled_reg_defaults[i].def = readl(dtsled_regs[val]);
+            i++;
+        }
+    }
+    dtsled_regmap_config.max_register = dtsled_nregs - 1;
+    dtsled_regmap_config.num_reg_defaults = i;
+    dtsled.regmap = regmap_init(dtsled.device, NULL, NULL, &dtsled_regmap_config);
+    if (IS_ERR(dtsled.regmap))
+    {
+        printk("regmap init failed!\r\n");
+        ret = PTR_ERR(dtsled.regmap);
+        goto fail_regmap;
+    }
+
+    /*打开时钟，设置复用、电气属性和方向，默认关闭所有LED*/
+    for (i = 0; i < dtsled.nleds; i++)
+    {
+        dtsled_led_setup(&dtsled_cfg[i], &dtsled.leds[i]);
+    }
+
+    /*硬件初始化完成以后再添加cdev，应用程序才能打开设备*/
+    dtsled.cdev.owner = THIS_MODULE;
+    cdev_init(&dtsled.cdev, &dtsled_fops);
+
+    /*添加一个cdev*/
+    ret = cdev_add(&dtsled.cdev, dtsled.devid, dtsled_CNT);
+    if (ret < 0)
+    {
+        goto fail_cdev;
     }
     return 0;
+
+    /*按申请的相反顺序释放，模块加载失败后不能留下类和设备*/
+fail_cdev:
+    regmap_exit(dtsled.regmap);
+fail_regmap:
+    device_destroy(dtsled.class, dtsled.devid);
+fail_device:
+    class_destroy(dtsled.class);
+fail_class:
+    unregister_chrdev_region(dtsled.devid, dtsled_CNT);
+fail_map:
+    dtsled_unmap_regs();
+fail_parse:
+    dtsled.nleds = 0;
+    return ret;
 }
 
 /*驱动出口函数*/
 static void __exit led_exit(void)
 {
-    /*取消映射*/
-    iounmap(IMX6U_CCM_CCGR1);
-    iounmap(SW_MUX_GPIO1_IO03);
-    iounmap(SW_PAD_GPIO1_IO03);
-    iounmap(GPIO1_DR);
-    iounmap(GPIO1_GDIR);
-
     /*删除字符设备*/
     cdev_del(&dtsled.cdev);
 
+    /*释放regmap后取消映射*/
+    regmap_exit(dtsled.regmap);
+    dtsled_unmap_regs();
+
     /*注销设备号*/
     unregister_chrdev_region(dtsled.devid, dtsled_CNT);
 
@@ -5,9 +5,76 @@
 #include "fcntl.h"
 #include "stdlib.h"
 #include "string.h"
+#include "stdint.h"
+#include "time.h"
+#include "sys/ioctl.h"
+#include "sys/mman.h"
+#include "linux/ioctl.h"
+#include "linux/types.h"
 
 #define LEDOFF 0
 #define LEDON 1
+
+/*与dtsled.c中的定义保持一致*/
+#define DTSLED_IOC_MAGIC       0xEB
+#define DTSLED_IOC_GET_MAPINFO (_IOWR(DTSLED_IOC_MAGIC, 0x1, struct dtsled_mapinfo))
+
+struct dtsled_mapinfo
+{
+    __u32 led;
+    __u32 dr_offset;
+    __u32 pin_mask;
+    __u32 active_low;
+};
+
+/*
+ * @description : 映射led所在的GPIO寄存器页，在用户空间直接翻转led，需要root权限
+ * @param - fd : 设备文件描述符
+ * @param - count : 翻转次数
+ * @param - led : led编号
+ * @return : 0 成功;其他 失败
+ */
+static int mmap_toggle(int fd, long count, unsigned int led)
+{
+    struct dtsled_mapinfo info;
+    volatile uint32_t *dr;
+    struct timespec start, end;
+    uint32_t val;
+    void *page;
+    long i;
+    double ns;
+
+    info.led = led;
+    if (ioctl(fd, DTSLED_IOC_GET_MAPINFO, &info) < 0)
+    {
+        return -1;
+    }
+    /*offset为led编号乘以页大小*/
+    page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)led * sysconf(_SC_PAGESIZE));
+    if (page == MAP_FAILED)
+    {
+        return -1;
+    }
+    dr = (volatile uint32_t *)((char *)page + info.dr_offset);
+
+    /*只读一次寄存器，之后在本地修改再写入*/
+    val = *dr;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < count; i++)
+    {
+        val ^= info.pin_mask;
+        *dr = val;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /*结束时关闭led*/
+    *dr = info.active_low ? (val | info.pin_mask) : (val & ~info.pin_mask);
+
+    ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("%ld toggles, %.1f ns per toggle\r\n", count, count > 0 ? ns / count : 0.0);
+    munmap(page, sysconf(_SC_PAGESIZE));
+    return 0;
+}
 /*
  * @description : main 主程序
  * @param - argc : argv 数组元素个数
@@ -19,7 +86,7 @@ int main(int argc, char *argv[])
     int fd, retvalue;
     char *filename;
     unsigned char databuf[1];
-    if (argc != 3)
+    if (argc != 3 && !((argc == 4 || argc == 5) && strcmp(argv[2], "toggle") == 0))
     {
         printf("Error Usage!\r\n");
         return -1;
@@ -32,6 +99,18 @@ int main(int argc, char *argv[])
         printf("file %s open failed!\r\n", argv[1]);
         return -1;
     }
+    /* ./ledApp /dev/dtsled toggle 1000000 [led]：通过mmap直接写寄存器翻转第led个led，默认第0个 */
+    if (argc >= 4)
+    {
+        retvalue = mmap_toggle(fd, atol(argv[3]), argc == 5 ? strtoul(argv[4], NULL, 0) : 0);
+        if (retvalue < 0)
+        {
+            printf("LED mmap Failed!\r\n");
+        }
+        close(fd);
+        return retvalue;
+    }
+
     /* 要执行的操作：打开或关闭 */
     databuf[0] = atoi(argv[2]); 
     
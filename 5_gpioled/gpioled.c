@@ -11,6 +11,14 @@
 #include <linux/of.h>
 #include <linux/of_address.h>
 #include <linux/of_gpio.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/version.h>
+#include <linux/gpio/consumer.h>
+#include <linux/leds.h>
 #include <asm/mach/map.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
@@ -19,6 +27,50 @@
 #define GPIOLED_NAME "gpioled" /*设备名*/
 #define LEDOFF 0               /*关灯*/
 #define LEDON 1                /*开灯*/
+#define GPIOLED_MAX_LEDS 32    /*最多的led个数，write的位掩码为32位*/
+
+/*ioctl命令*/
+#define GPIOLED_IOC_MAGIC         0xED
+#define GPIOLED_IOC_PATTERN_SET   (_IOW(GPIOLED_IOC_MAGIC, 0x1, struct led_pattern)) /*上传并开始播放闪烁模式*/
+#define GPIOLED_IOC_PATTERN_STOP  (_IO(GPIOLED_IOC_MAGIC, 0x2))                      /*停止播放*/
+#define GPIOLED_IOC_PWM_SET       (_IOW(GPIOLED_IOC_MAGIC, 0x3, struct led_pwm))     /*设置亮度（软件PWM）*/
+
+#define LED_PWM_MAX_DUTY 255       /*占空比的最大值，表示常亮*/
+#define LED_PWM_MAX_HZ   2000      /*PWM的最高频率，周期至少是最短阶段的十倍，占空比才有意义*/
+#define LED_PWM_MIN_NS   (50 * NSEC_PER_USEC) /*高电平或低电平最短的持续时间，短于中断处理的开销时定时器会一直补跑，占空比接近0或255时会被拉长*/
+
+#define LED_PATTERN_MAX_STEPS 256 /*一个模式最多的步数*/
+#define LED_PATTERN_MIN_US    (LED_PWM_MIN_NS / NSEC_PER_USEC) /*每一步最短的持续时间，和PWM的最短阶段相同，防止定时器把CPU占满*/
+
+/*闪烁模式的一步：电平和持续时间*/
+struct led_pattern_step
+{
+    __u32 level;       /*LEDON或LEDOFF*/
+    __u32 duration_us; /*持续时间，单位微秒*/
+};
+
+/*
+GPIOLED_IOC_PATTERN_SET的参数，steps紧跟在结构体后面，一共nsteps个
+repeat为播放的次数，0表示一直播放，直到GPIOLED_IOC_PATTERN_STOP或write
+播放结束后led保持在最后一步的电平
+该结构体与ledApp.c中的定义保持一致
+*/
+struct led_pattern
+{
+    __u32 nsteps;                   /*步数*/
+    __u32 repeat;                   /*播放次数*/
+    struct led_pattern_step steps[];
+};
+
+/*
+GPIOLED_IOC_PWM_SET的参数，duty为0时熄灭、为255时常亮，这两种情况不使用定时器
+该结构体与ledApp.c中的定义保持一致
+*/
+struct led_pwm
+{
+    __u32 duty;    /*占空比，0~255*/
+    __u32 freq_hz; /*频率，1~2000Hz*/
+};
 
 /*gpioled设备结构体*/
 struct gpioled_dev
@@ -30,7 +82,24 @@ struct gpioled_dev
     int major;              /*主设备号*/
     int minor;              /*次设备号*/
     struct device_node *nd; /*设备节点*/
-    int led_gpio;           /*led所使用的GPIO编号*/
+    int led_gpio;           /*第0个led的GPIO编号，闪烁模式在这个led上播放*/
+    int led_gpios[GPIOLED_MAX_LEDS];              /*所有led的GPIO编号*/
+    struct gpio_desc *led_descs[GPIOLED_MAX_LEDS]; /*对应的GPIO描述符，用于一次设置多个GPIO*/
+    unsigned int nleds;     /*led个数*/
+    struct mutex lock;      /*串行化write和ioctl*/
+    struct hrtimer pattern_timer;          /*播放闪烁模式的高精度定时器*/
+    struct led_pattern_step *pattern_steps; /*闪烁模式，定时器停止时才能修改*/
+    unsigned int pattern_nsteps;           /*步数*/
+    unsigned int pattern_pos;              /*下一步的序号*/
+    unsigned int pattern_left;             /*剩余的播放次数，repeat为0时不使用*/
+    unsigned int pattern_repeat;           /*播放次数，0表示一直播放*/
+    struct hrtimer pwm_timer;              /*软件PWM的高精度定时器*/
+    ktime_t pwm_on;                        /*一个周期中点亮的时间*/
+    ktime_t pwm_off;                       /*一个周期中熄灭的时间*/
+    bool pwm_lit;                          /*当前处于点亮阶段*/
+    struct led_classdev leds[GPIOLED_MAX_LEDS]; /*LED子系统中的led：/sys/class/leds/gpioled<N>*/
+    char led_names[GPIOLED_MAX_LEDS][16];       /*led的名字*/
+    unsigned int nleds_registered;              /*已经注册到LED子系统的个数*/
 };
 
 struct gpioled_dev gpioled; /*led设备*/
@@ -38,6 +107,262 @@ struct gpioled_dev gpioled; /*led设备*/
 
 
 
+/*
+描述：闪烁模式的定时器回调，在中断上下文中直接设置GPIO，然后把定时器推后这一步的持续时间
+      hrtimer_forward_now从上一次的到期时间开始累加，误差不会随步数积累
+参数：timer：pattern_timer
+return：HRTIMER_RESTART继续播放；HRTIMER_NORESTART播放结束
+*/
+static enum hrtimer_restart led_pattern_timer(struct hrtimer *timer)
+{
+    struct gpioled_dev *dev = container_of(timer, struct gpioled_dev, pattern_timer);
+    struct led_pattern_step *step;
+
+    /*播放完一遍*/
+    if (dev->pattern_pos == dev->pattern_nsteps)
+    {
+        dev->pattern_pos = 0;
+        if (dev->pattern_repeat != 0 && --dev->pattern_left == 0)
+        {
+            return HRTIMER_NORESTART;
+        }
+    }
+
+    step = &dev->pattern_steps[dev->pattern_pos++];
+    gpio_set_value(dev->led_gpio, step->level == LEDON ? 0 : 1); /*低电平点亮*/
+    hrtimer_forward_now(timer, ns_to_ktime((u64)step->duration_us * NSEC_PER_USEC));
+    return HRTIMER_RESTART;
+}
+
+/*
+描述：停止播放并释放闪烁模式，调用者持有dev->lock
+参数：dev：设备结构体
+return：无
+*/
+static void led_pattern_stop(struct gpioled_dev *dev)
+{
+    hrtimer_cancel(&dev->pattern_timer); /*等待正在执行的回调结束*/
+    kfree(dev->pattern_steps);
+    dev->pattern_steps = NULL;
+    dev->pattern_nsteps = 0;
+}
+
+/*
+描述：软件PWM的定时器回调，翻转led并把到期时间推到下一阶段结束
+      两个阶段的长度在设置时已经算好，回调中没有除法，每秒几千次翻转的开销很小
+      回调来晚时hrtimer_forward丢掉已经错过的周期，不会让到期时间落在过去而被连续补跑
+参数：timer：pwm_timer
+return：HRTIMER_RESTART
+*/
+static enum hrtimer_restart led_pwm_timer(struct hrtimer *timer)
+{
+    struct gpioled_dev *dev = container_of(timer, struct gpioled_dev, pwm_timer);
+
+    dev->pwm_lit = !dev->pwm_lit;
+    gpio_set_value(dev->led_gpio, !dev->pwm_lit); /*低电平点亮*/
+    hrtimer_forward(timer, hrtimer_cb_get_time(timer), dev->pwm_lit ? dev->pwm_on : dev->pwm_off);
+    return HRTIMER_RESTART;
+}
+
+/*
+描述：停止软件PWM，led保持当前电平，调用者持有dev->lock
+参数：dev：设备结构体
+return：无
+*/
+static void led_pwm_stop(struct gpioled_dev *dev)
+{
+    hrtimer_cancel(&dev->pwm_timer);
+}
+
+/*
+描述：设置亮度，停止闪烁模式，按占空比和频率启动软件PWM，调用者持有dev->lock
+参数：dev：设备结构体
+      arg：用户空间的struct led_pwm
+return：0成功；其他失败
+*/
+static int led_pwm_set(struct gpioled_dev *dev, unsigned long arg)
+{
+    struct led_pwm pwm;
+    u32 period, on;
+
+    if (copy_from_user(&pwm, (void __user *)arg, sizeof(pwm)))
+    {
+        return -EFAULT;
+    }
+    if (pwm.duty > LED_PWM_MAX_DUTY || pwm.freq_hz == 0 || pwm.freq_hz > LED_PWM_MAX_HZ)
+    {
+        return -EINVAL;
+    }
+    if (gpio_cansleep(dev->led_gpio))
+    {
+        return -EOPNOTSUPP;
+    }
+
+    led_pattern_stop(dev);
+    led_pwm_stop(dev);
+
+    /*全灭或全亮时不需要定时器*/
+    if (pwm.duty == 0 || pwm.duty == LED_PWM_MAX_DUTY)
+    {
+        gpio_set_value(dev->led_gpio, pwm.duty == 0);
+        return 0;
+    }
+
+    period = NSEC_PER_SEC / pwm.freq_hz;
+    on = div_u64((u64)period * pwm.duty, LED_PWM_MAX_DUTY);
+    on = clamp_t(u32, on, LED_PWM_MIN_NS, period - LED_PWM_MIN_NS);
+    dev->pwm_on = ns_to_ktime(on);
+    dev->pwm_off = ns_to_ktime(period - on);
+
+    /*从点亮阶段开始*/
+    dev->pwm_lit = true;
+    gpio_set_value(dev->led_gpio, 0);
+    hrtimer_start(&dev->pwm_timer, dev->pwm_on, HRTIMER_MODE_REL);
+    return 0;
+}
+
+/*
+描述：从用户空间复制闪烁模式并开始播放，第一步立即执行
+参数：dev：设备结构体
+      arg：用户空间的struct led_pattern
+return：0成功；其他失败
+*/
+static int led_pattern_set(struct gpioled_dev *dev, unsigned long arg)
+{
+    struct led_pattern __user *upattern = (struct led_pattern __user *)arg;
+    struct led_pattern pattern;
+    struct led_pattern_step *steps;
+    unsigned int i;
+
+    if (copy_from_user(&pattern, upattern, sizeof(pattern)))
+    {
+        return -EFAULT;
+    }
+    if (pattern.nsteps == 0 || pattern.nsteps > LED_PATTERN_MAX_STEPS)
+    {
+        return -EINVAL;
+    }
+
+    /*定时器回调在中断上下文中设置GPIO，不支持可能休眠的GPIO（例如I2C扩展芯片）*/
+    if (gpio_cansleep(dev->led_gpio))
+    {
+        return -EOPNOTSUPP;
+    }
+
+    steps = memdup_user(upattern->steps, pattern.nsteps * sizeof(*steps));
+    if (IS_ERR(steps))
+    {
+        return PTR_ERR(steps);
+    }
+    for (i = 0; i < pattern.nsteps; i++)
+    {
+        if (steps[i].duration_us < LED_PATTERN_MIN_US)
+        {
+            kfree(steps);
+            return -EINVAL;
+        }
+    }
+
+    /*定时器停止以后才能替换模式*/
+    led_pattern_stop(dev);
+    led_pwm_stop(dev);
+    dev->pattern_steps = steps;
+    dev->pattern_nsteps = pattern.nsteps;
+    dev->pattern_pos = 0;
+    dev->pattern_repeat = pattern.repeat;
+    dev->pattern_left = pattern.repeat;
+    hrtimer_start(&dev->pattern_timer, ktime_set(0, 0), HRTIMER_MODE_REL);
+    return 0;
+}
+
+/*
+描述：按位掩码设置所有led，第i位为1表示第i个led点亮（低电平）
+      内核支持GPIO数组接口时，同一个GPIO控制器上的引脚合并为一次寄存器写入
+参数：dev：设备结构体
+      mask：位掩码
+return：无
+*/
+static void led_set_mask(struct gpioled_dev *dev, u32 mask)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+    DECLARE_BITMAP(values, GPIOLED_MAX_LEDS);
+
+    values[0] = ~mask; /*低电平点亮，多出的位不使用*/
+    gpiod_set_array_value(dev->nleds, dev->led_descs, NULL, values);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+    int values[GPIOLED_MAX_LEDS];
+    unsigned int i;
+
+    for (i = 0; i < dev->nleds; i++)
+    {
+        values[i] = !(mask & BIT(i));
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+    gpiod_set_array_value(dev->nleds, dev->led_descs, values);
+#else
+    gpiod_set_array(dev->nleds, dev->led_descs, values); /*4.3以前的名字*/
+#endif
+#else
+    unsigned int i;
+
+    /*没有GPIO数组接口的内核只能逐个设置*/
+    for (i = 0; i < dev->nleds; i++)
+    {
+        gpio_set_value(dev->led_gpios[i], !(mask & BIT(i)));
+    }
+#endif
+}
+
+/*
+描述：LED子系统设置亮度的回调，内核中的触发器（timer、heartbeat等）可能在定时器中断里调用，不能休眠
+参数：cdev：led_classdev
+      value：亮度，LED_OFF熄灭，其他值点亮
+return：无
+*/
+static void led_classdev_set(struct led_classdev *cdev, enum led_brightness value)
+{
+    unsigned int i = cdev - gpioled.leds;
+
+    gpio_set_value(gpioled.led_gpios[i], value == LED_OFF); /*低电平点亮*/
+}
+
+/*
+描述：把每个led注册到LED子系统，内核中的触发器可以直接驱动它们，不需要用户空间的守护进程
+      设备树中的linux,default-trigger作为默认触发器，例如"heartbeat"
+      字符设备的接口保持不变，两种方式同时控制同一个led时，后设置的生效
+参数：dev：设备结构体
+return：无，注册失败只打印信息，不影响字符设备
+*/
+static void led_classdev_init(struct gpioled_dev *dev)
+{
+    struct led_classdev *cdev;
+    unsigned int i;
+
+    for (i = 0; i < dev->nleds; i++)
+    {
+        /*触发器可能在中断上下文中设置亮度，跳过可能休眠的GPIO*/
+        if (gpio_cansleep(dev->led_gpios[i]))
+        {
+            printk("led-gpio %u can sleep, not registered as led class device\r\n", i);
+            break;
+        }
+
+        cdev = &dev->leds[i];
+        snprintf(dev->led_names[i], sizeof(dev->led_names[i]), "%s%u", GPIOLED_NAME, i);
+        cdev->name = dev->led_names[i];
+        cdev->max_brightness = 1;
+        cdev->brightness_set = led_classdev_set;
+        of_property_read_string(dev->nd, "linux,default-trigger", &cdev->default_trigger);
+
+        if (led_classdev_register(dev->device, cdev) < 0)
+        {
+            printk("can't register %s\r\n", cdev->name);
+            break;
+        }
+        dev->nleds_registered++;
+    }
+}
+
 /*打开设备*/
 static int led_open(struct inode *inode, struct file *filp)
 {
@@ -51,37 +376,76 @@ static ssize_t led_read(struct file *filp, char __user *buf, size_t cnt, loff_t
     return 0;
 }
 
-/*向设备写数据*/
+/*
+描述：向设备写数据，数据为1~4字节的小端位掩码，第i位控制第i个led，一次write更新所有led
+      只有一个led时写入1字节的LEDON/LEDOFF，与原来的用法相同
+参数：filp：设备文件
+      buf：用户空间的数据
+      cnt：数据长度
+      offt：未使用
+return：写入的字节数；负数失败
+*/
 static ssize_t led_write(struct file *filp, const char __user *buf, size_t cnt, loff_t *offt)
 {
-    int retvalue;
-    unsigned char databuf[1];
-    unsigned char ledstat;
+    unsigned char databuf[4] = {0};
+    u32 mask;
 
     /*通过读取文件的私有数据得到设备结构体变量*/
     struct gpioled_dev *dev = filp->private_data;
 
+    if (cnt == 0 || cnt > sizeof(databuf))
+    {
+        return -EINVAL;
+    }
+
     /*获取从用户空间得到的信息*/
-    retvalue = copy_from_user(databuf, buf, cnt);
-    if (retvalue < 0)
+    if (copy_from_user(databuf, buf, cnt))
     {
         printk("kernel write failed!\r\n");
         return -EFAULT;
     }
+    mask = databuf[0] | databuf[1] << 8 | databuf[2] << 16 | (u32)databuf[3] << 24;
 
-    /*获取状态值*/
-    ledstat = databuf[0];
-    if (ledstat == LEDON)
-    {
-        /*直接通过调用gpio_set_value来向gpio写入数据，来实现开关灯的效果*/
-        gpio_set_value(dev->led_gpio, 0); /*打开led灯*/
-    }
-    else if (ledstat == LEDOFF)
+    /*手动控制时停止正在播放的闪烁模式*/
+    mutex_lock(&dev->lock);
+    led_pattern_stop(dev);
+    led_pwm_stop(dev);
+    led_set_mask(dev, mask);
+    mutex_unlock(&dev->lock);
+
+    return cnt;
+}
+
+/*
+描述：ioctl，上传或停止闪烁模式
+参数：filp：设备文件
+      cmd：命令
+      arg：参数
+return：0成功；其他失败
+*/
+static long led_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct gpioled_dev *dev = filp->private_data;
+    long ret = 0;
+
+    mutex_lock(&dev->lock);
+    switch (cmd)
     {
-        gpio_set_value(dev->led_gpio, 1); /*关闭led灯*/
+    case GPIOLED_IOC_PATTERN_SET: /*上传并播放闪烁模式*/
+        ret = led_pattern_set(dev, arg);
+        break;
+    case GPIOLED_IOC_PATTERN_STOP: /*停止播放，led保持当前电平*/
+        led_pattern_stop(dev);
+        break;
+    case GPIOLED_IOC_PWM_SET: /*设置亮度*/
+        ret = led_pwm_set(dev, arg);
+        break;
+    default:
+        ret = -ENOTTY;
+        break;
     }
-
-    return 0;
+    mutex_unlock(&dev->lock);
+    return ret;
 }
 
 /*关闭/释放设备*/
@@ -96,6 +460,7 @@ static struct file_operations led_fops = {
     .open = led_open,
     .read = led_read,
     .write = led_write,
+    .unlocked_ioctl = led_unlocked_ioctl,
     .release = led_release,
 };
 
@@ -103,6 +468,7 @@ static struct file_operations led_fops = {
 static int __init led_init(void)
 {
     int ret = 0;
+    unsigned int i;
 
     /*设置LED所使用的GPIO*/
 
@@ -118,21 +484,46 @@ static int __init led_init(void)
         printk("gpioled node has been found!\r\n");
     }
 
-    /*2、获取设备树中的gpio属性，得到LED的GPIO编号*/
-    gpioled.led_gpio = of_get_named_gpio(gpioled.nd, "led-gpio", 0);
-    if (gpioled.led_gpio < 0)
+    /*2、获取设备树中的gpio属性，得到LED的GPIO编号：优先使用led-gpios列表，没有时使用单个led-gpio*/
+    ret = of_gpio_named_count(gpioled.nd, "led-gpios");
+    if (ret > 0)
     {
-        printk("can't get led-gpio");
-        return -EINVAL;
+        gpioled.nleds = min(ret, GPIOLED_MAX_LEDS);
+        for (i = 0; i < gpioled.nleds; i++)
+        {
+            gpioled.led_gpios[i] = of_get_named_gpio(gpioled.nd, "led-gpios", i);
+        }
+    }
+    else
+    {
+        gpioled.nleds = 1;
+        gpioled.led_gpios[0] = of_get_named_gpio(gpioled.nd, "led-gpio", 0);
     }
-    printk("led-gpio num = %d\r\n", gpioled.led_gpio);
 
-    /*3、设置GPIO1_IO03为输出，并且输出高电平，默认关闭led灯*/
-    ret = gpio_direction_output(gpioled.led_gpio, 1);
-    if (ret < 0)
+    for (i = 0; i < gpioled.nleds; i++)
     {
-        printk("can't set gpio!\r\n");
+        if (gpioled.led_gpios[i] < 0)
+        {
+            printk("can't get led-gpio %u", i);
+            return -EINVAL;
+        }
+        printk("led-gpio %u num = %d\r\n", i, gpioled.led_gpios[i]);
+        gpioled.led_descs[i] = gpio_to_desc(gpioled.led_gpios[i]);
+
+        /*3、设置为输出，并且输出高电平，默认关闭led灯*/
+        ret = gpio_direction_output(gpioled.led_gpios[i], 1);
+        if (ret < 0)
+        {
+            printk("can't set gpio!\r\n");
+        }
     }
+    gpioled.led_gpio = gpioled.led_gpios[0];
+
+    mutex_init(&gpioled.lock);
+    hrtimer_init(&gpioled.pattern_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    gpioled.pattern_timer.function = led_pattern_timer;
+    hrtimer_init(&gpioled.pwm_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    gpioled.pwm_timer.function = led_pwm_timer;
 
     /*注册字符设备驱动*/
     /*1、创建设备号*/
@@ -171,12 +562,25 @@ static int __init led_init(void)
         return PTR_ERR(gpioled.device);
     }
 
+    /*5、注册到LED子系统*/
+    led_classdev_init(&gpioled);
+
     return 0;
 }
 
 /*驱动出口函数*/
 static void __exit led_exit(void)
 {
+    /*从LED子系统注销，停止触发器*/
+    while (gpioled.nleds_registered > 0)
+    {
+        led_classdev_unregister(&gpioled.leds[--gpioled.nleds_registered]);
+    }
+
+    /*停止播放闪烁模式和软件PWM*/
+    led_pattern_stop(&gpioled);
+    led_pwm_stop(&gpioled);
+
     /*注销字符设备驱动*/
     cdev_del(&gpioled.cdev); /*删除cdev*/
     unregister_chrdev_region(gpioled.devid, GPIOLED_CNT);
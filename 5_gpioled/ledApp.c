@@ -5,9 +5,90 @@
 #include "fcntl.h"
 #include "stdlib.h"
 #include "string.h"
+#include "sys/ioctl.h"
+#include "linux/ioctl.h"
+#include "linux/types.h"
 
 #define LEDOFF 0
 #define LEDON 1
+
+/*与gpioled.c中的定义保持一致*/
+#define GPIOLED_IOC_MAGIC         0xED
+#define GPIOLED_IOC_PATTERN_SET   (_IOW(GPIOLED_IOC_MAGIC, 0x1, struct led_pattern))
+#define GPIOLED_IOC_PATTERN_STOP  (_IO(GPIOLED_IOC_MAGIC, 0x2))
+#define GPIOLED_IOC_PWM_SET       (_IOW(GPIOLED_IOC_MAGIC, 0x3, struct led_pwm))
+#define LED_PATTERN_MAX_STEPS 256
+
+struct led_pattern_step
+{
+    __u32 level;
+    __u32 duration_us;
+};
+
+struct led_pwm
+{
+    __u32 duty;
+    __u32 freq_hz;
+};
+
+struct led_pattern
+{
+    __u32 nsteps;
+    __u32 repeat;
+    struct led_pattern_step steps[];
+};
+
+/*
+ * @description : 上传闪烁模式，由驱动中的高精度定时器播放
+ * @param - fd : 设备文件描述符
+ * @param - argc : 参数个数
+ * @param - argv : argv[3]为播放次数（0表示一直播放），之后每个参数为"电平:微秒"
+ * @return : 0 成功;其他 失败
+ */
+static int pattern_upload(int fd, int argc, char *argv[])
+{
+    struct led_pattern *pattern;
+    unsigned int level, us;
+    int i, nsteps = argc - 4, ret;
+
+    if (nsteps <= 0 || nsteps > LED_PATTERN_MAX_STEPS)
+    {
+        printf("pattern needs 1 to %d steps\r\n", LED_PATTERN_MAX_STEPS);
+        return -1;
+    }
+
+    pattern = malloc(sizeof(*pattern) + nsteps * sizeof(pattern->steps[0]));
+    if (pattern == NULL)
+    {
+        return -1;
+    }
+    pattern->nsteps = nsteps;
+    pattern->repeat = atoi(argv[3]);
+    for (i = 0; i < nsteps; i++)
+    {
+        if (sscanf(argv[4 + i], "%u:%u", &level, &us) != 2)
+        {
+            printf("bad step %s, expect level:us\r\n", argv[4 + i]);
+            free(pattern);
+            return -1;
+        }
+        pattern->steps[i].level = level;
+        pattern->steps[i].duration_us = us;
+    }
+
+    ret = ioctl(fd, GPIOLED_IOC_PATTERN_SET, pattern);
+    free(pattern);
+    return ret;
+}
+/*
+ * ./ledApp /dev/gpioled 1                        开灯
+ * ./ledApp /dev/gpioled 0                        关灯
+ * ./ledApp /dev/gpioled mask 0x5                 多个led时按位掩码设置，第0和第2个led点亮
+ * ./ledApp /dev/gpioled pattern 0 1:100000 0:900000   每秒闪一次，一直播放
+ * ./ledApp /dev/gpioled stop                     停止播放
+ * ./ledApp /dev/gpioled pwm 64 1000              亮度64/255，PWM频率1kHz
+ */
+
 /*
  * @description : main 主程序
  * @param - argc : argv 数组元素个数
@@ -19,7 +100,7 @@ int main(int argc, char *argv[])
     int fd, retvalue;
     char *filename;
     unsigned char databuf[1];
-    if (argc != 3)
+    if (argc < 3 || (argc != 3 && strcmp(argv[2], "pattern") != 0 && strcmp(argv[2], "mask") != 0 && strcmp(argv[2], "pwm") != 0))
     {
         printf("Error Usage!\r\n");
         return -1;
@@ -32,6 +113,56 @@ int main(int argc, char *argv[])
         printf("file %s open failed!\r\n", argv[1]);
         return -1;
     }
+    /* 闪烁模式：上传一次，之后每一步都不需要系统调用 */
+    if (strcmp(argv[2], "pattern") == 0 || strcmp(argv[2], "stop") == 0)
+    {
+        if (strcmp(argv[2], "pattern") == 0)
+        {
+            retvalue = pattern_upload(fd, argc, argv);
+        }
+        else
+        {
+            retvalue = ioctl(fd, GPIOLED_IOC_PATTERN_STOP);
+        }
+        if (retvalue < 0)
+        {
+            printf("LED Pattern Failed!\r\n");
+        }
+        close(fd);
+        return retvalue < 0 ? -1 : 0;
+    }
+
+    /* 亮度由驱动中的软件PWM产生，不需要用户空间循环 */
+    if (strcmp(argv[2], "pwm") == 0 && argc == 5)
+    {
+        struct led_pwm pwm;
+
+        pwm.duty = atoi(argv[3]);
+        pwm.freq_hz = atoi(argv[4]);
+        retvalue = ioctl(fd, GPIOLED_IOC_PWM_SET, &pwm);
+        if (retvalue < 0)
+        {
+            printf("LED PWM Failed!\r\n");
+        }
+        close(fd);
+        return retvalue < 0 ? -1 : 0;
+    }
+
+    /* 一次write设置所有led，4字节小端位掩码 */
+    if (strcmp(argv[2], "mask") == 0 && argc == 4)
+    {
+        unsigned int mask = strtoul(argv[3], NULL, 0);
+        unsigned char maskbuf[4] = {mask, mask >> 8, mask >> 16, mask >> 24};
+
+        retvalue = write(fd, maskbuf, sizeof(maskbuf));
+        if (retvalue < 0)
+        {
+            printf("LED Control Failed!\r\n");
+        }
+        close(fd);
+        return retvalue < 0 ? -1 : 0;
+    }
+
     /* 要执行的操作：打开或关闭 */
     databuf[0] = atoi(argv[2]); 
     